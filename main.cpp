@@ -1,448 +1,4104 @@
 #include <iostream>
+#include <fstream>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <shared_mutex>
+#include <thread>
 #include <string>
+#include <string_view>
+#include <sstream>
 #include <vector>
 #include <queue>
+#include <unordered_map>
+#include <memory>
+#include <algorithm>
 #include <ctime>
+#include <filesystem>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <csignal>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#if defined(CALENDAR_BENCH)
+#include <cmath>
+#include <cstdlib>
 #include <iomanip>
-#include <sstream>
+#include <list>
+#include <new>
+#include <random>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#endif
+#endif
+
+using namespace std;
+
+#if defined(CALENDAR_BENCH)
+const int PROBE_BUCKETS = 8;
+
+struct BenchCounters
+{
+    atomic<long long> allocations{0};
+    atomic<long long> hash_lookups{0};
+    atomic<long long> hash_probes{0};
+    atomic<long long> probe_lengths[PROBE_BUCKETS] = {};
+    atomic<long long> day_spills{0};
+    atomic<long long> cleanup_runs{0};
+    atomic<long long> cleanup_touched{0};
+};
+
+BenchCounters bench_counters;
+
+// Kept out of line so GCC does not pair an inlined malloc or free with a new or delete expression.
+__attribute__((noinline)) void *operator new(size_t size)
+{
+    bench_counters.allocations.fetch_add(1, memory_order_relaxed);
+    if (void *memory = malloc(size ? size : 1))
+        return memory;
+    throw bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+__attribute__((noinline)) void operator delete(void *memory, size_t) noexcept
+{
+    free(memory);
+}
+
+void count_probe(int probes)
+{
+    bench_counters.hash_lookups.fetch_add(1, memory_order_relaxed);
+    bench_counters.hash_probes.fetch_add(probes, memory_order_relaxed);
+    bench_counters.probe_lengths[min(probes, PROBE_BUCKETS) - 1].fetch_add(1, memory_order_relaxed);
+}
+
+void count_spill()
+{
+    bench_counters.day_spills.fetch_add(1, memory_order_relaxed);
+}
+
+void count_cleanup(int touched)
+{
+    bench_counters.cleanup_runs.fetch_add(1, memory_order_relaxed);
+    bench_counters.cleanup_touched.fetch_add(touched, memory_order_relaxed);
+}
+#else
+inline void count_probe(int) {}
+inline void count_spill() {}
+inline void count_cleanup(int) {}
+#endif
+
+// Names read from the snapshot point into its mapping until they are changed.
+struct EventName
+{
+    string text;
+    const char *mapped = nullptr;
+    uint32_t length = 0;
+
+    EventName() = default;
+    EventName(string owned) : text(move(owned)) {}
+    EventName(const char *owned) : text(owned) {}
+    EventName(const char *data, uint32_t size) : mapped(data), length(size) {}
+
+    string_view view() const
+    {
+        return mapped ? string_view(mapped, length) : string_view(text);
+    }
+
+    operator string_view() const
+    {
+        return view();
+    }
+
+    string str() const
+    {
+        return string(view());
+    }
+
+    size_t size() const
+    {
+        return mapped ? length : text.size();
+    }
+
+    const char *data() const
+    {
+        return mapped ? mapped : text.data();
+    }
+};
+
+ostream &operator<<(ostream &out, const EventName &name)
+{
+    return out << name.view();
+}
+
+struct Event
+{
+    int date;
+    EventName name;
+    int priority;
+    bool expired = false;
+    long long stamp = 0;
+    long long order = 0;
+};
+
+template <typename T>
+struct Pool
+{
+    vector<T> items;
+    vector<int> free_list;
+
+    int create(const T &item)
+    {
+        if (free_list.empty())
+        {
+            items.push_back(item);
+            return items.size() - 1;
+        }
+
+        int handle = free_list.back();
+        free_list.pop_back();
+        items[handle] = item;
+        return handle;
+    }
+
+    void release(int handle)
+    {
+        items[handle] = T();
+        free_list.push_back(handle);
+    }
+
+    T &operator[](int handle)
+    {
+        return items[handle];
+    }
+};
+
+Pool<Event> event_pool;
+atomic<long long> event_stamps{0};
+atomic<long long> event_orders{0};
+mutex pool_mutex;
+
+// Events of equal priority keep the order they were linked in, so a day's list is strictly
+// ordered and an event can be found by binary search.
+bool more_urgent(int a, int b)
+{
+    const Event &x = event_pool[a];
+    const Event &y = event_pool[b];
+    return x.priority != y.priority ? x.priority < y.priority : x.order < y.order;
+}
+
+int days_from_civil(int year, int month, int day)
+{
+    year -= month <= 2;
+    int era = (year >= 0 ? year : year - 399) / 400;
+    int year_of_era = year - era * 400;
+    int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+int days_in_month(int month, int year)
+{
+    static const int lengths[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+    return (month == 2 && leap) ? 29 : lengths[month - 1];
+}
+
+void civil_from_days(int days, int &year, int &month, int &day)
+{
+    days += 719468;
+    int era = (days >= 0 ? days : days - 146096) / 146097;
+    int day_of_era = days - era * 146097;
+    int year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 - day_of_era / 146096) / 365;
+    int day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 - year_of_era / 100);
+    int shifted_month = (5 * day_of_year + 2) / 153;
+    day = day_of_year - (153 * shifted_month + 2) / 5 + 1;
+    month = shifted_month < 10 ? shifted_month + 3 : shifted_month - 9;
+    year = year_of_era + era * 400 + (month <= 2);
+}
+
+bool parse_date(const string &text, int &date)
+{
+    if (text.size() != 10 || text[2] != '/' || text[5] != '/')
+        return false;
+
+    int fields[3] = {0, 0, 0};
+    int starts[3] = {0, 3, 6};
+    int widths[3] = {2, 2, 4};
+    for (int f = 0; f < 3; f++)
+    {
+        for (int i = starts[f]; i < starts[f] + widths[f]; i++)
+        {
+            if (text[i] < '0' || text[i] > '9')
+                return false;
+            fields[f] = fields[f] * 10 + (text[i] - '0');
+        }
+    }
+
+    int day = fields[0];
+    int month = fields[1];
+    int year = fields[2];
+    if (year < 1 || month < 1 || month > 12 ||
+        day < 1 || day > days_in_month(month, year))
+        return false;
+
+    date = days_from_civil(year, month, day);
+    return true;
+}
+
+bool valid_date(int date)
+{
+    return date >= days_from_civil(1, 1, 1) && date <= days_from_civil(9999, 12, 31);
+}
+
+int weekday(int date)
+{
+    return ((date + 4) % 7 + 7) % 7;
+}
+
+int current_date()
+{
+    time_t now = time(nullptr);
+    tm current;
+#if defined(_WIN32)
+    localtime_s(&current, &now);
+#else
+    localtime_r(&now, &current);
+#endif
+    return days_from_civil(current.tm_year + 1900, current.tm_mon + 1, current.tm_mday);
+}
+
+#if defined(CALENDAR_BENCH) || defined(CALENDAR_TEST)
+atomic<int> fake_today{INT_MIN};
+#endif
+
+int calendar_today()
+{
+#if defined(CALENDAR_BENCH) || defined(CALENDAR_TEST)
+    int fake = fake_today;
+    if (fake != INT_MIN)
+        return fake;
+#endif
+    return current_date();
+}
+
+chrono::system_clock::time_point next_midnight()
+{
+    time_t now = time(nullptr);
+    tm midnight;
+#if defined(_WIN32)
+    localtime_s(&midnight, &now);
+#else
+    localtime_r(&now, &midnight);
+#endif
+    midnight.tm_hour = 0;
+    midnight.tm_min = 0;
+    midnight.tm_sec = 0;
+    midnight.tm_mday++;
+    midnight.tm_isdst = -1;
+    return chrono::system_clock::from_time_t(mktime(&midnight));
+}
+
+string format_date(int date)
+{
+    int year, month, day;
+    civil_from_days(date, year, month, day);
+
+    string text = "dd/mm/yyyy";
+    text[0] = '0' + day / 10;
+    text[1] = '0' + day % 10;
+    text[3] = '0' + month / 10;
+    text[4] = '0' + month % 10;
+    for (int i = 9; i >= 6; i--, year /= 10)
+        text[i] = '0' + year % 10;
+    return text;
+}
+
+struct DayList
+{
+    static const int INLINE_CAPACITY = 4;
+
+    int count = 0;
+    int capacity = INLINE_CAPACITY;
+    union
+    {
+        int inline_items[INLINE_CAPACITY];
+        int *heap_items;
+    };
+
+    DayList() {}
+    DayList(const DayList &) = delete;
+    DayList &operator=(const DayList &) = delete;
+
+    DayList(DayList &&other) noexcept
+    {
+        take(other);
+    }
+
+    DayList &operator=(DayList &&other) noexcept
+    {
+        if (this != &other)
+        {
+            release();
+            take(other);
+        }
+        return *this;
+    }
+
+    ~DayList()
+    {
+        release();
+    }
+
+    bool spilled() const
+    {
+        return capacity > INLINE_CAPACITY;
+    }
+
+    int *begin()
+    {
+        return spilled() ? heap_items : inline_items;
+    }
+
+    const int *begin() const
+    {
+        return spilled() ? heap_items : inline_items;
+    }
+
+    int *end()
+    {
+        return begin() + count;
+    }
+
+    const int *end() const
+    {
+        return begin() + count;
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    int &operator[](size_t index)
+    {
+        return begin()[index];
+    }
+
+    const int &operator[](size_t index) const
+    {
+        return begin()[index];
+    }
+
+    void reserve(size_t wanted)
+    {
+        if ((int)wanted <= capacity)
+            return;
+
+        if (!spilled())
+            count_spill();
+        int grown = max((int)wanted, capacity * 2);
+        int *items = new int[grown];
+        copy(begin(), end(), items);
+        release();
+        heap_items = items;
+        capacity = grown;
+    }
+
+    int *insert(int *position, int value)
+    {
+        int index = position - begin();
+        reserve(count + 1);
+        int *items = begin();
+        copy_backward(items + index, items + count, items + count + 1);
+        items[index] = value;
+        count++;
+        return items + index;
+    }
+
+    void push_back(int value)
+    {
+        insert(end(), value);
+    }
+
+    int *erase(int *position)
+    {
+        copy(position + 1, end(), position);
+        count--;
+        return position;
+    }
+
+    void release()
+    {
+        if (spilled())
+            delete[] heap_items;
+    }
+
+    void take(DayList &other)
+    {
+        count = other.count;
+        capacity = other.capacity;
+        if (other.spilled())
+            heap_items = other.heap_items;
+        else
+            copy(other.inline_items, other.inline_items + other.count, inline_items);
+        other.count = 0;
+        other.capacity = INLINE_CAPACITY;
+    }
+};
+
+struct MonthBucket
+{
+    DayList days[31];
+    uint32_t scheduled = 0;
+};
+
+struct HashTable
+{
+    struct Slot
+    {
+        int key = 0;
+        bool used = false;
+        MonthBucket month;
+    };
+
+    vector<Slot> table = vector<Slot>(16);
+    vector<int> ordered_keys;
+    int used_count = 0;
+
+    static int month_key(int year, int month)
+    {
+        return year * 12 + month - 1;
+    }
+
+    static unsigned hash(int key)
+    {
+        unsigned h = (unsigned)key;
+        h ^= h >> 16;
+        h *= 0x45d9f3bu;
+        h ^= h >> 16;
+        return h;
+    }
+
+    int find_slot(int key) const
+    {
+        unsigned mask = table.size() - 1;
+        unsigned index = hash(key) & mask;
+        int probes = 1;
+        while (table[index].used && table[index].key != key)
+        {
+            index = (index + 1) & mask;
+            probes++;
+        }
+        count_probe(probes);
+        return index;
+    }
+
+    void grow()
+    {
+        vector<Slot> old(table.size() * 2);
+        old.swap(table);
+        for (auto &slot : old)
+        {
+            if (!slot.used)
+                continue;
+            Slot &target = table[find_slot(slot.key)];
+            target.key = slot.key;
+            target.used = true;
+            target.month = move(slot.month);
+        }
+    }
+
+    MonthBucket &get_month(int year, int month)
+    {
+        int key = month_key(year, month);
+        int index = find_slot(key);
+        if (!table[index].used)
+        {
+            if ((used_count + 1) * 10 > (int)table.size() * 7)
+            {
+                grow();
+                index = find_slot(key);
+            }
+            table[index].key = key;
+            table[index].used = true;
+            used_count++;
+            ordered_keys.insert(lower_bound(ordered_keys.begin(), ordered_keys.end(), key), key);
+        }
+        return table[index].month;
+    }
+
+    const MonthBucket *find_month(int year, int month) const
+    {
+        const Slot &slot = table[find_slot(month_key(year, month))];
+        return slot.used ? &slot.month : nullptr;
+    }
+
+    DayList &get(int date)
+    {
+        int year, month, day;
+        civil_from_days(date, year, month, day);
+        return get_month(year, month).days[day - 1];
+    }
+
+    const DayList *find(int date) const
+    {
+        int year, month, day;
+        civil_from_days(date, year, month, day);
+        const MonthBucket *bucket = find_month(year, month);
+        return bucket ? &bucket->days[day - 1] : nullptr;
+    }
+
+    bool contains(int date) const
+    {
+        const DayList *events = find(date);
+        return events && !events->empty();
+    }
+};
+
+HashTable events_map;
+
+// Each month's days are guarded by one stripe. Readers and single-day writers hold store_mutex
+// shared plus the stripes they touch; store_mutex is held exclusively only to add a month, grow
+// the event pool, change rules, undo, redo or compact, so readers of other months never wait
+// for a writer or for cleanup.
+shared_mutex store_mutex;
+const int MONTH_STRIPES = 64;
+shared_mutex month_stripes[MONTH_STRIPES];
+
+int month_stripe(int date)
+{
+    int year, month, day;
+    civil_from_days(date, year, month, day);
+    return HashTable::month_key(year, month) % MONTH_STRIPES;
+}
+
+struct RangeReadLock
+{
+    bool held[MONTH_STRIPES] = {};
+
+    RangeReadLock(int from, int to)
+    {
+        if ((long long)to - from >= MONTH_STRIPES * 31LL)
+            fill(begin(held), end(held), true);
+        else
+        {
+            for (int date = from; date <= to; date += 28)
+                held[month_stripe(date)] = true;
+            held[month_stripe(to)] = true;
+        }
+        for (int i = 0; i < MONTH_STRIPES; i++)
+        {
+            if (held[i])
+                month_stripes[i].lock_shared();
+        }
+    }
+
+    ~RangeReadLock()
+    {
+        for (int i = 0; i < MONTH_STRIPES; i++)
+        {
+            if (held[i])
+                month_stripes[i].unlock_shared();
+        }
+    }
+
+    RangeReadLock(const RangeReadLock &) = delete;
+    RangeReadLock &operator=(const RangeReadLock &) = delete;
+};
+
+struct DayWriteLock
+{
+    shared_lock<shared_mutex> store{store_mutex, defer_lock};
+    unique_lock<shared_mutex> whole_store{store_mutex, defer_lock};
+    unique_lock<shared_mutex> month;
+
+    DayWriteLock(int date, bool exclusive = false)
+    {
+        if (!exclusive)
+        {
+            store.lock();
+            if (events_map.find(date))
+            {
+                month = unique_lock(month_stripes[month_stripe(date)]);
+                return;
+            }
+            store.unlock();
+        }
+        whole_store.lock();
+    }
+
+    bool exclusive() const
+    {
+        return whole_store.owns_lock();
+    }
+};
+
+// Days that still have to expire, soonest first. A day is pushed once; MonthBucket::scheduled
+// marks the days that are already in the heap and is guarded by the month's stripe, the heap
+// and the watermark by expiry_mutex.
+priority_queue<int, vector<int>, greater<int>> expiry_dates;
+atomic<int> expiry_watermark{INT_MIN};
+atomic<int> cleanup_touched{0};
+mutex expiry_mutex;
+
+bool schedule_expiry_date(int date)
+{
+    int year, month, day;
+    civil_from_days(date, year, month, day);
+    uint32_t &scheduled = events_map.get_month(year, month).scheduled;
+
+    lock_guard<mutex> lock(expiry_mutex);
+    if (date < expiry_watermark)
+        return false;
+    if (!(scheduled & 1u << (day - 1)))
+    {
+        scheduled |= 1u << (day - 1);
+        expiry_dates.push(date);
+    }
+    return true;
+}
+
+void schedule_expiry(Event &event)
+{
+    if (!schedule_expiry_date(event.date))
+        event.expired = true;
+}
+
+const char *STORE_PATH = "calendar.db";
+const char *STORE_TEMP_PATH = "calendar.db.tmp";
+const char *LOG_PATH = "calendar.log";
+const int COMPACT_THRESHOLD = 4096;
+
+struct StoreHeader
+{
+    char magic[4];
+    uint32_t count;
+    uint32_t heap_size;
+    uint32_t generation;
+};
+
+struct StoreRecord
+{
+    int32_t date;
+    uint8_t priority;
+    uint8_t expired;
+    uint16_t reserved;
+    uint32_t name_offset;
+    uint32_t name_length;
+};
+
+enum LogOp : uint8_t
+{
+    LOG_ADD = 1,
+    LOG_EDIT = 2,
+    LOG_DELETE = 3
+};
+
+struct LogHeader
+{
+    char magic[4];
+    uint32_t generation;
+};
+
+struct LogRecord
+{
+    uint8_t op;
+    uint8_t priority;
+    uint8_t expired;
+    uint8_t reserved;
+    int32_t date;
+    uint32_t index;
+    uint32_t name_length;
+};
+
+ofstream store_log;
+int log_records = 0;
+uint32_t store_generation = 0;
+mutex log_mutex;
+atomic<bool> log_dirty{false};
+
+void write_log_header(ostream &log)
+{
+    LogHeader header = {{'L', 'O', 'G', '1'}, store_generation};
+    log.write((const char *)&header, sizeof(header));
+}
+
+bool open_log()
+{
+    error_code error;
+    uintmax_t size = filesystem::file_size(LOG_PATH, error);
+    store_log.open(LOG_PATH, ios::binary | ios::app);
+    if (error || size == 0)
+        write_log_header(store_log);
+    return store_log.is_open();
+}
+
+void log_operation(LogOp op, int date, int index, const Event &event)
+{
+    if (!store_log.is_open())
+        return;
+
+    LogRecord record = {op, (uint8_t)event.priority, event.expired, 0,
+                        date, (uint32_t)index, (uint32_t)event.name.size()};
+    lock_guard<mutex> lock(log_mutex);
+    store_log.write((const char *)&record, sizeof(record));
+    store_log.write(event.name.data(), event.name.size());
+    log_records++;
+    log_dirty = true;
+}
+
+void link_event(int handle)
+{
+    Event &event = event_pool[handle];
+    event.stamp = ++event_stamps;
+    event.order = ++event_orders;
+    schedule_expiry(event);
+
+    DayList &events = events_map.get(event.date);
+    events.insert(upper_bound(events.begin(), events.end(), handle, more_urgent), handle);
+
+    log_operation(LOG_ADD, event.date, 0, event);
+}
+
+// Without the whole store locked the pool must not reallocate under readers of other months,
+// so this returns -1 instead of growing it.
+int insert_event(const Event &e, bool may_grow = true)
+{
+    int handle;
+    {
+        lock_guard<mutex> lock(pool_mutex);
+        if (!may_grow && event_pool.free_list.empty() && event_pool.items.size() == event_pool.items.capacity())
+            return -1;
+        handle = event_pool.create(e);
+    }
+    link_event(handle);
+    return handle;
+}
+
+void update_event(int date, int index, const EventName &name, int priority)
+{
+    int handle = events_map.get(date)[index];
+    Event &event = event_pool[handle];
+    event.stamp = ++event_stamps;
+    event.name = name;
+
+    if (event.priority != priority)
+    {
+        DayList &events = events_map.get(date);
+        events.erase(events.begin() + index);
+        event.priority = priority;
+        event.order = ++event_orders;
+        events.insert(upper_bound(events.begin(), events.end(), handle, more_urgent), handle);
+    }
+
+    log_operation(LOG_EDIT, date, index, event);
+}
+
+template <typename Visit>
+void for_each_month(int from, int to, Visit visit)
+{
+    for (int first = from; first <= to;)
+    {
+        int year, month, day;
+        civil_from_days(first, year, month, day);
+        int month_end = first + days_in_month(month, year) - day;
+        visit(year, month, day, day + min(month_end, to) - first);
+        first = month_end + 1;
+    }
+}
+
+template <typename Visit>
+void for_each_day(int from, int to, Visit visit)
+{
+    if (from > to)
+        return;
+
+    int year, month, day;
+    civil_from_days(from, year, month, day);
+    int first_key = HashTable::month_key(year, month);
+    civil_from_days(to, year, month, day);
+    int last_key = HashTable::month_key(year, month);
+
+    const vector<int> &keys = events_map.ordered_keys;
+    for (auto key = lower_bound(keys.begin(), keys.end(), first_key); key != keys.end() && *key <= last_key; ++key)
+    {
+        year = *key / 12;
+        month = *key % 12 + 1;
+        const MonthBucket &bucket = *events_map.find_month(year, month);
+        int first = days_from_civil(year, month, 1);
+        int last = min(first + days_in_month(month, year) - 1, to);
+        for (int date = max(first, from); date <= last; date++)
+        {
+            if (!bucket.days[date - first].empty())
+                visit(date, bucket.days[date - first]);
+        }
+    }
+}
+
+enum StatusFilter
+{
+    ANY_STATUS,
+    ACTIVE_ONLY,
+    EXPIRED_ONLY
+};
+
+struct EventFilter
+{
+    int min_priority = 1;
+    int max_priority = 5;
+    int status = ANY_STATUS;
+
+    bool matches(int priority, bool expired) const
+    {
+        return priority >= min_priority && priority <= max_priority &&
+               (status == ANY_STATUS || (status == EXPIRED_ONLY) == expired);
+    }
+};
+
+template <typename Visit>
+void for_each_event(int from, int to, const EventFilter &filter, Visit visit)
+{
+    for_each_day(from, to, [&](int, const DayList &events)
+                 {
+                     for (int handle : events)
+                     {
+                         const Event &event = event_pool[handle];
+                         if (event.priority > filter.max_priority)
+                             break;
+                         if (filter.matches(event.priority, event.expired))
+                             visit(handle);
+                     }
+                 });
+}
+
+vector<int> most_urgent(int from, int to, int count)
+{
+    struct Cursor
+    {
+        const DayList *events;
+        size_t index;
+    };
+
+    auto later = [](const Cursor &a, const Cursor &b)
+    {
+        const Event &x = event_pool[(*a.events)[a.index]];
+        const Event &y = event_pool[(*b.events)[b.index]];
+        return x.priority != y.priority ? x.priority > y.priority : x.date > y.date;
+    };
+    priority_queue<Cursor, vector<Cursor>, decltype(later)> heads(later);
+
+    for_each_day(from, to, [&](int, const DayList &events)
+                 { heads.push(Cursor{&events, 0}); });
+
+    vector<int> urgent;
+    while (!heads.empty() && (int)urgent.size() < count)
+    {
+        Cursor top = heads.top();
+        heads.pop();
+        urgent.push_back((*top.events)[top.index]);
+        if (++top.index < top.events->size())
+            heads.push(top);
+    }
+    return urgent;
+}
+
+enum Frequency
+{
+    DAILY,
+    WEEKLY,
+    MONTHLY,
+    YEARLY
+};
+
+struct RecurrenceRule
+{
+    int start;
+    int frequency;
+    int interval = 1;
+    int count = 0;
+    int until = INT_MAX;
+    vector<int> exceptions;
+    string name;
+    int priority;
+};
+
+struct MonthOccurrences
+{
+    vector<int> days[31];
+};
+
+const char *RULES_PATH = "calendar.rules";
+const char *RULES_TEMP_PATH = "calendar.rules.tmp";
+const size_t OCCURRENCE_CACHE_MONTHS = 36;
+const int MAX_INTERVAL = 9999;
+
+vector<RecurrenceRule> rules;
+mutex occurrence_mutex;
+unordered_map<int, shared_ptr<const MonthOccurrences>> occurrence_cache;
+
+void expand_rule(const RecurrenceRule &rule, int index, int year, int month, MonthOccurrences &occurrences)
+{
+    int first = days_from_civil(year, month, 1);
+    int last = first + days_in_month(month, year) - 1;
+    if (rule.start > last || rule.until < first)
+        return;
+
+    auto add = [&](int date, int occurrence)
+    {
+        if (date < first || date > last || date < rule.start || date > rule.until)
+            return;
+        if (rule.count > 0 && occurrence >= rule.count)
+            return;
+        if (binary_search(rule.exceptions.begin(), rule.exceptions.end(), date))
+            return;
+        occurrences.days[date - first].push_back(index);
+    };
+
+    if (rule.frequency == DAILY || rule.frequency == WEEKLY)
+    {
+        int step = rule.interval * (rule.frequency == WEEKLY ? 7 : 1);
+        int occurrence = first > rule.start ? (first - rule.start + step - 1) / step : 0;
+        for (int date = rule.start + occurrence * step; date <= last; date += step, occurrence++)
+            add(date, occurrence);
+        return;
+    }
+
+    int start_year, start_month, start_day;
+    civil_from_days(rule.start, start_year, start_month, start_day);
+    int months = (year * 12 + month) - (start_year * 12 + start_month);
+    int periods = rule.frequency == YEARLY ? months / 12 : months;
+    if (months < 0 || (rule.frequency == YEARLY && months % 12 != 0) || periods % rule.interval != 0)
+        return;
+
+    if (start_day > days_in_month(month, year))
+        return;
+
+    int period = periods / rule.interval;
+    int occurrence = period;
+    if (rule.count > 0 && start_day > 28)
+    {
+        occurrence = 0;
+        int step = rule.frequency == YEARLY ? rule.interval * 12 : rule.interval;
+        int key = HashTable::month_key(start_year, start_month);
+        for (int i = 0; i < period && occurrence < rule.count; i++, key += step)
+        {
+            if (start_day <= days_in_month(key % 12 + 1, key / 12))
+                occurrence++;
+        }
+    }
+    add(days_from_civil(year, month, start_day), occurrence);
+}
+
+shared_ptr<const MonthOccurrences> expand_month(int year, int month)
+{
+    int key = HashTable::month_key(year, month);
+    {
+        lock_guard<mutex> lock(occurrence_mutex);
+        auto it = occurrence_cache.find(key);
+        if (it != occurrence_cache.end())
+            return it->second;
+    }
+
+    auto occurrences = make_shared<MonthOccurrences>();
+    for (size_t i = 0; i < rules.size(); i++)
+        expand_rule(rules[i], i, year, month, *occurrences);
+    for (auto &day : occurrences->days)
+    {
+        stable_sort(day.begin(), day.end(), [](int a, int b)
+                    { return rules[a].priority < rules[b].priority; });
+    }
+
+    lock_guard<mutex> lock(occurrence_mutex);
+    if (occurrence_cache.size() >= OCCURRENCE_CACHE_MONTHS)
+        occurrence_cache.clear();
+    occurrence_cache[key] = occurrences;
+    return occurrences;
+}
+
+bool save_rules()
+{
+    ofstream file(RULES_TEMP_PATH, ios::trunc);
+    for (const auto &rule : rules)
+    {
+        file << rule.start << '\t' << rule.frequency << '\t' << rule.interval << '\t'
+             << rule.count << '\t' << rule.until << '\t' << rule.priority << '\t';
+        for (size_t i = 0; i < rule.exceptions.size(); i++)
+            file << (i ? "," : "") << rule.exceptions[i];
+        file << "\t" << rule.name << "\n";
+    }
+    file.close();
+    if (!file)
+        return false;
+
+    if (rename(RULES_TEMP_PATH, RULES_PATH) != 0)
+    {
+        remove(RULES_PATH);
+        if (rename(RULES_TEMP_PATH, RULES_PATH) != 0)
+            return false;
+    }
+    return true;
+}
+
+bool load_rules()
+{
+    ifstream file(RULES_PATH);
+    if (!file)
+        return true;
+
+    string line;
+    try
+    {
+        while (getline(file, line))
+        {
+            istringstream fields(line);
+            RecurrenceRule rule;
+            string exceptions;
+            if (!(fields >> rule.start >> rule.frequency >> rule.interval >> rule.count >> rule.until >> rule.priority))
+                return false;
+            fields.ignore();
+            getline(fields, exceptions, '\t');
+            getline(fields, rule.name);
+            if (rule.frequency < DAILY || rule.frequency > YEARLY || rule.interval < 1 ||
+                rule.interval > MAX_INTERVAL || rule.count < 0 || !valid_date(rule.start) ||
+                (rule.until != INT_MAX && !valid_date(rule.until)) || rule.priority < 1 || rule.priority > 5)
+                return false;
+
+            istringstream dates(exceptions);
+            string date;
+            while (getline(dates, date, ','))
+            {
+                rule.exceptions.push_back(stoi(date));
+                if (!valid_date(rule.exceptions.back()))
+                    return false;
+            }
+            sort(rule.exceptions.begin(), rule.exceptions.end());
+            rules.push_back(rule);
+        }
+    }
+    catch (...)
+    {
+        return false;
+    }
+    return true;
+}
+
+void rules_changed()
+{
+    {
+        lock_guard<mutex> lock(occurrence_mutex);
+        occurrence_cache.clear();
+    }
+    if (!save_rules())
+        cerr << "Could not save " << RULES_PATH << "\n";
+}
+
+void add_rule(RecurrenceRule rule)
+{
+    sort(rule.exceptions.begin(), rule.exceptions.end());
+    rules.push_back(rule);
+    rules_changed();
+}
+
+void remove_rule(int index)
+{
+    rules.erase(rules.begin() + index);
+    rules_changed();
+}
+
+void add_rule_exception(int index, int date)
+{
+    vector<int> &exceptions = rules[index].exceptions;
+    auto position = lower_bound(exceptions.begin(), exceptions.end(), date);
+    if (position == exceptions.end() || *position != date)
+        exceptions.insert(position, date);
+    rules_changed();
+}
+
+bool parse_count(const string &text, int &value)
+{
+    if (text.empty() || text.size() > 9)
+        return false;
+
+    value = 0;
+    for (char c : text)
+    {
+        if (c < '0' || c > '9')
+            return false;
+        value = value * 10 + (c - '0');
+    }
+    return true;
+}
+
+bool parse_frequency(char letter, int &frequency)
+{
+    const char letters[] = "dwmy";
+    const char *found = strchr(letters, tolower(letter));
+    if (!letter || !found)
+        return false;
+    frequency = found - letters;
+    return true;
+}
+
+string describe_rule(const RecurrenceRule &rule)
+{
+    static const char *units[] = {"day", "week", "month", "year"};
+    string text = rule.name + " (Priority: " + to_string(rule.priority) + ") every ";
+    if (rule.interval > 1)
+        text += to_string(rule.interval) + " ";
+    text += units[rule.frequency];
+    if (rule.interval > 1)
+        text += "s";
+    text += " from " + format_date(rule.start);
+    if (rule.count > 0)
+        text += ", " + to_string(rule.count) + " times";
+    if (rule.until != INT_MAX)
+        text += ", until " + format_date(rule.until);
+    if (!rule.exceptions.empty())
+        text += ", " + to_string(rule.exceptions.size()) + " skipped";
+    return text;
+}
+
+template <typename VisitEvent, typename VisitOccurrence>
+void for_each_entry(int from, int to, const EventFilter &filter, VisitEvent visit_event, VisitOccurrence visit_occurrence)
+{
+    if (rules.empty())
+    {
+        for_each_event(from, to, filter, visit_event);
+        return;
+    }
+
+    int today = calendar_today();
+    for_each_month(from, to, [&](int year, int month, int first_day, int last_day)
+                   {
+                       const MonthBucket *bucket = events_map.find_month(year, month);
+                       shared_ptr<const MonthOccurrences> occurrences = expand_month(year, month);
+                       int first = days_from_civil(year, month, 1);
+                       for (int day = first_day; day <= last_day; day++)
+                       {
+                           static const DayList no_events;
+                           const DayList &events = bucket ? bucket->days[day - 1] : no_events;
+                           const vector<int> &recurring = occurrences->days[day - 1];
+                           int date = first + day - 1;
+                           size_t i = 0, j = 0;
+                           while (i < events.size() || j < recurring.size())
+                           {
+                               if (i == events.size() ||
+                                   (j < recurring.size() && rules[recurring[j]].priority < event_pool[events[i]].priority))
+                               {
+                                   int rule = recurring[j++];
+                                   if (filter.matches(rules[rule].priority, date < today))
+                                       visit_occurrence(rule, date);
+                               }
+                               else
+                               {
+                                   const Event &event = event_pool[events[i]];
+                                   if (filter.matches(event.priority, event.expired))
+                                       visit_event(events[i]);
+                                   i++;
+                               }
+                           }
+                       }
+                   });
+}
+
+enum Period
+{
+    PER_DAY,
+    PER_WEEK,
+    PER_MONTH
+};
+
+int period_index(int from, int date, int period)
+{
+    if (period == PER_DAY)
+        return date - from;
+    if (period == PER_WEEK)
+        return (date - (from - weekday(from))) / 7;
+
+    int from_year, from_month, year, month, day;
+    civil_from_days(from, from_year, from_month, day);
+    civil_from_days(date, year, month, day);
+    return HashTable::month_key(year, month) - HashTable::month_key(from_year, from_month);
+}
+
+int period_start(int from, int index, int period)
+{
+    if (period == PER_DAY)
+        return from + index;
+    if (period == PER_WEEK)
+        return from - weekday(from) + index * 7;
+
+    int year, month, day;
+    civil_from_days(from, year, month, day);
+    int key = HashTable::month_key(year, month) + index;
+    return days_from_civil(key / 12, key % 12 + 1, 1);
+}
+
+void count_events(int from, int to, const EventFilter &filter, int period, vector<int> &counts)
+{
+    counts.assign(period_index(from, to, period) + 1, 0);
+    int last_date = INT_MIN, index = 0;
+    auto count_for = [&](int date) -> int &
+    {
+        if (date != last_date)
+        {
+            last_date = date;
+            index = period_index(from, date, period);
+        }
+        return counts[index];
+    };
+    for_each_entry(from, to, filter,
+                   [&](int handle)
+                   { count_for(event_pool[handle].date)++; },
+                   [&](int, int date)
+                   { count_for(date)++; });
+}
+
+int unlink_event(int date, int index)
+{
+    DayList &events = events_map.get(date);
+    int handle = events[index];
+    event_pool[handle].stamp = ++event_stamps;
+    log_operation(LOG_DELETE, date, index, event_pool[handle]);
+
+    events.erase(events.begin() + index);
+    return handle;
+}
+
+void release_event(int handle)
+{
+    lock_guard<mutex> lock(pool_mutex);
+    event_pool.release(handle);
+}
+
+void remove_event(int date, int index)
+{
+    release_event(unlink_event(date, index));
+}
+
+int event_index(int handle)
+{
+    const DayList &events = events_map.get(event_pool[handle].date);
+    auto position = lower_bound(events.begin(), events.end(), handle, more_urgent);
+    if (position == events.end() || *position != handle)
+        return events.size();
+    return position - events.begin();
+}
+
+enum JournalOp
+{
+    JOURNAL_ADD,
+    JOURNAL_EDIT,
+    JOURNAL_DELETE
+};
+
+struct JournalEntry
+{
+    int op;
+    int handle;
+    int priority;
+    long long before;
+    long long after;
+    EventName name;
+};
+
+const int JOURNAL_CAPACITY = 256;
+
+struct Journal
+{
+    vector<JournalEntry> ring = vector<JournalEntry>(JOURNAL_CAPACITY);
+    int first = 0;
+    int size = 0;
+    int applied = 0;
+
+    JournalEntry &at(int position)
+    {
+        return ring[(first + position) % JOURNAL_CAPACITY];
+    }
+};
+
+Journal interactive_journal;
+
+enum StepResult
+{
+    STEP_NONE,
+    STEP_CONFLICT,
+    STEP_DONE
+};
+
+void forget_entry(JournalEntry &entry, bool applied)
+{
+    bool detached = entry.op == JOURNAL_DELETE ? applied : entry.op == JOURNAL_ADD && !applied;
+    if (detached)
+        release_event(entry.handle);
+    entry.name = EventName();
+}
+
+void forget_undone(Journal &journal)
+{
+    while (journal.size > journal.applied)
+        forget_entry(journal.at(--journal.size), false);
+}
+
+void forget_applied(Journal &journal, int count)
+{
+    for (int i = 0; i < count; i++)
+        forget_entry(journal.at(i), true);
+    journal.first = (journal.first + count) % JOURNAL_CAPACITY;
+    journal.size -= count;
+    journal.applied -= count;
+}
+
+void clear_journal(Journal &journal)
+{
+    forget_undone(journal);
+    forget_applied(journal, journal.applied);
+}
+
+void record_operation(Journal &journal, int op, int handle, int priority, const EventName &name, long long before)
+{
+    forget_undone(journal);
+    if (journal.size == JOURNAL_CAPACITY)
+        forget_applied(journal, 1);
+
+    JournalEntry &entry = journal.at(journal.size++);
+    entry.op = op;
+    entry.handle = handle;
+    entry.priority = priority;
+    entry.before = before;
+    entry.after = event_pool[handle].stamp;
+    entry.name = name;
+    journal.applied++;
+}
+
+int journal_add(Journal &journal, const Event &e, bool may_grow = true)
+{
+    int handle = insert_event(e, may_grow);
+    if (handle == -1)
+        return -1;
+    record_operation(journal, JOURNAL_ADD, handle, 0, EventName(), 0);
+    return handle;
+}
+
+void journal_edit(Journal &journal, int date, int index, const EventName &name, int priority)
+{
+    int handle = events_map.get(date)[index];
+    Event &event = event_pool[handle];
+    EventName previous = event.name;
+    int previous_priority = event.priority;
+    long long before = event.stamp;
+    update_event(date, index, name, priority);
+    record_operation(journal, JOURNAL_EDIT, handle, previous_priority, previous, before);
+}
+
+void journal_delete(Journal &journal, int date, int index)
+{
+    long long before = event_pool[events_map.get(date)[index]].stamp;
+    int handle = unlink_event(date, index);
+    record_operation(journal, JOURNAL_DELETE, handle, 0, EventName(), before);
+}
+
+// Adds under the event's month stripe and retries with the whole store locked when the month
+// is new or the pool has to grow.
+int locked_add(Journal &journal, const Event &e)
+{
+    {
+        DayWriteLock lock(e.date);
+        int handle = journal_add(journal, e, lock.exclusive());
+        if (handle != -1)
+            return handle;
+    }
+    DayWriteLock lock(e.date, true);
+    return journal_add(journal, e);
+}
+
+bool apply_entry(JournalEntry &entry, bool undo)
+{
+    Event &event = event_pool[entry.handle];
+    if (event.stamp != (undo ? entry.after : entry.before))
+        return false;
+
+    if (entry.op == JOURNAL_EDIT)
+    {
+        EventName name = move(entry.name);
+        int priority = entry.priority;
+        entry.name = event.name;
+        entry.priority = event.priority;
+        update_event(event.date, event_index(entry.handle), name, priority);
+    }
+    else if ((entry.op == JOURNAL_ADD) == undo)
+        unlink_event(event.date, event_index(entry.handle));
+    else
+        link_event(entry.handle);
+    event.stamp = undo ? entry.before : entry.after;
+    return true;
+}
+
+StepResult undo_operation(Journal &journal)
+{
+    if (journal.applied == 0)
+        return STEP_NONE;
+    if (apply_entry(journal.at(journal.applied - 1), true))
+    {
+        journal.applied--;
+        return STEP_DONE;
+    }
+
+    forget_undone(journal);
+    forget_applied(journal, journal.applied);
+    return STEP_CONFLICT;
+}
+
+StepResult redo_operation(Journal &journal)
+{
+    if (journal.applied == journal.size)
+        return STEP_NONE;
+    if (apply_entry(journal.at(journal.applied), false))
+    {
+        journal.applied++;
+        return STEP_DONE;
+    }
+
+    forget_undone(journal);
+    return STEP_CONFLICT;
+}
+
+bool read_store(const char *data, size_t size)
+{
+    StoreHeader header = {};
+    bool legacy = size >= 4 && memcmp(data, "CAL1", 4) == 0;
+    size_t header_size = legacy ? offsetof(StoreHeader, generation) : sizeof(header);
+    if (size < header_size)
+        return false;
+    memcpy(&header, data, header_size);
+
+    if ((!legacy && memcmp(header.magic, "CAL2", 4) != 0) ||
+        size != header_size + (size_t)header.count * sizeof(StoreRecord) + header.heap_size)
+        return false;
+
+    store_generation = header.generation;
+    const char *records = data + header_size;
+    const char *heap = records + (size_t)header.count * sizeof(StoreRecord);
+    event_pool.items.reserve(event_pool.items.size() + header.count);
+
+    int last_date = INT_MIN, last_priority = 0;
+    DayList *day = nullptr;
+    for (uint32_t i = 0; i < header.count; i++)
+    {
+        StoreRecord record;
+        memcpy(&record, records + i * sizeof(record), sizeof(record));
+        if ((uint64_t)record.name_offset + record.name_length > header.heap_size ||
+            !valid_date(record.date) || record.priority < 1 || record.priority > 5 ||
+            record.date < last_date || (record.date == last_date && record.priority < last_priority))
+            return false;
+        last_priority = record.priority;
+
+        Event e;
+        e.date = record.date;
+        e.name = EventName(heap + record.name_offset, record.name_length);
+        e.priority = record.priority;
+        e.expired = record.expired;
+
+        if (e.date != last_date)
+        {
+            schedule_expiry(e);
+            day = &events_map.get(e.date);
+            last_date = e.date;
+        }
+        e.order = ++event_orders;
+        day->push_back(event_pool.create(e));
+    }
+    return true;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+void *store_mapping = nullptr;
+size_t store_mapping_size = 0;
+#else
+vector<char> store_bytes;
+#endif
+
+// The loaded events keep pointing into the previous mapping, so the store must be empty here.
+bool load_store()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    if (store_mapping)
+        munmap(store_mapping, store_mapping_size);
+    store_mapping = nullptr;
+
+    int fd = open(STORE_PATH, O_RDONLY);
+    if (fd < 0)
+        return errno == ENOENT;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    size_t size = info.st_size;
+    if (size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    store_mapping = data;
+    store_mapping_size = size;
+    return read_store((const char *)data, size);
+#else
+    ifstream file(STORE_PATH, ios::binary);
+    if (!file)
+        return true;
+
+    store_bytes.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+    return read_store(store_bytes.data(), store_bytes.size());
+#endif
+}
+
+bool replay_log()
+{
+    ifstream file(LOG_PATH, ios::binary | ios::ate);
+    if (!file)
+        return true;
+
+    streamoff size = file.tellg();
+    streamoff complete = 0;
+    file.seekg(0);
+
+    // A log written before the last snapshot is already part of it; replaying it would apply its records twice.
+    bool stale = store_generation != 0;
+    LogHeader header;
+    if (file.read((char *)&header, sizeof(header)) && memcmp(header.magic, "LOG1", 4) == 0)
+    {
+        if (header.generation > store_generation)
+            return false;
+        stale = header.generation < store_generation;
+        complete = sizeof(header);
+    }
+    if (stale)
+    {
+        file.close();
+        error_code error;
+        filesystem::resize_file(LOG_PATH, 0, error);
+        return !error;
+    }
+    file.clear();
+    file.seekg(complete);
+
+    LogRecord record;
+    while (file.read((char *)&record, sizeof(record)))
+    {
+        if (record.op > LOG_DELETE || !valid_date(record.date) || record.priority < 1 || record.priority > 5)
+            return false;
+        if (record.name_length > size - complete - (streamoff)sizeof(record))
+            break;
+
+        Event e;
+        e.date = record.date;
+        e.priority = record.priority;
+        string name(record.name_length, '\0');
+        if (!file.read(&name[0], record.name_length))
+            break;
+        e.name = move(name);
+
+        const DayList *events = events_map.find(e.date);
+        int count = events ? events->size() : 0;
+
+        if (record.op == LOG_ADD)
+        {
+            e.expired = record.expired;
+            insert_event(e);
+        }
+        else if (record.op == LOG_EDIT && (int)record.index < count)
+            update_event(e.date, record.index, e.name, e.priority);
+        else if (record.op == LOG_DELETE && (int)record.index < count)
+            remove_event(e.date, record.index);
+        else
+            return false;
+
+        log_records++;
+        complete += sizeof(record) + record.name_length;
+    }
+    file.close();
+
+    if (complete < size)
+    {
+        error_code error;
+        filesystem::resize_file(LOG_PATH, complete, error);
+        return !error;
+    }
+    return true;
+}
+
+bool save_store()
+{
+    vector<StoreRecord> records;
+    string heap;
+    for (int key : events_map.ordered_keys)
+    {
+        int year = key / 12;
+        int month = key % 12 + 1;
+        const MonthBucket &bucket = *events_map.find_month(year, month);
+        for (int day = 1; day <= 31; day++)
+        {
+            int date = days_from_civil(year, month, day);
+            for (int handle : bucket.days[day - 1])
+            {
+                const Event &event = event_pool[handle];
+                records.push_back({date, (uint8_t)event.priority, event.expired, 0,
+                                   (uint32_t)heap.size(), (uint32_t)event.name.size()});
+                heap += event.name;
+            }
+        }
+    }
+
+    StoreHeader header = {{'C', 'A', 'L', '2'}, (uint32_t)records.size(), (uint32_t)heap.size(), store_generation + 1};
+    ofstream file(STORE_TEMP_PATH, ios::binary | ios::trunc);
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)records.data(), records.size() * sizeof(StoreRecord));
+    file.write(heap.data(), heap.size());
+    file.close();
+    if (!file)
+        return false;
+
+    if (rename(STORE_TEMP_PATH, STORE_PATH) != 0)
+    {
+        remove(STORE_PATH);
+        if (rename(STORE_TEMP_PATH, STORE_PATH) != 0)
+            return false;
+    }
+    store_generation++;
+    return true;
+}
+
+void compact_store(int threshold = 0)
+{
+    lock_guard<mutex> lock(log_mutex);
+    if (log_records < threshold)
+        return;
+
+    if (!save_store())
+    {
+        cout << "\033[1;31mCould not save " << STORE_PATH << "!\033[0m\n";
+        return;
+    }
+
+    store_log.close();
+    store_log.open(LOG_PATH, ios::binary | ios::trunc);
+    write_log_header(store_log);
+    log_records = 0;
+}
+
+void flush_log()
+{
+    if (!log_dirty.exchange(false))
+        return;
+
+    {
+        lock_guard<mutex> lock(log_mutex);
+        store_log.flush();
+        if (log_records < COMPACT_THRESHOLD)
+            return;
+    }
+
+    unique_lock lock(store_mutex);
+    compact_store(COMPACT_THRESHOLD);
+}
+
+bool parse_import_line(const string &line, Event &e)
+{
+    size_t first = line.find(',');
+    size_t last = line.rfind(',');
+    if (first == string::npos || first == last)
+        return false;
+
+    size_t end = line.size();
+    if (line[end - 1] == '\r')
+        end--;
+    if (end != last + 2 || line[last + 1] < '1' || line[last + 1] > '5')
+        return false;
+
+    if (!parse_date(line.substr(0, first), e.date))
+        return false;
+    e.name = line.substr(first + 1, last - first - 1);
+    e.priority = line[last + 1] - '0';
+    return true;
+}
+
+int import_events(istream &in)
+{
+    vector<int> imported;
+    string line;
+    int line_number = 0;
+    while (getline(in, line))
+    {
+        line_number++;
+        if (line.empty() || line == "\r")
+            continue;
+
+        Event e;
+        if (!parse_import_line(line, e))
+        {
+            cerr << "Skipping invalid record on line " << line_number << "\n";
+            continue;
+        }
+        int handle = event_pool.create(e);
+        imported.push_back(handle);
+    }
+
+    stable_sort(imported.begin(), imported.end(), [](int a, int b)
+                {
+                    const Event &x = event_pool[a];
+                    const Event &y = event_pool[b];
+                    return x.date != y.date ? x.date < y.date : x.priority < y.priority;
+                });
+
+    for (size_t start = 0, end; start < imported.size(); start = end)
+    {
+        int date = event_pool[imported[start]].date;
+        end = start;
+        while (end < imported.size() && event_pool[imported[end]].date == date)
+            end++;
+
+        if (!schedule_expiry_date(date))
+        {
+            for (size_t i = start; i < end; i++)
+                event_pool[imported[i]].expired = true;
+        }
+
+        DayList &events = events_map.get(date);
+        int existing = events.size();
+        events.reserve(existing + end - start);
+        for (size_t i = start; i < end; i++)
+        {
+            event_pool[imported[i]].order = ++event_orders;
+            events.push_back(imported[i]);
+        }
+        inplace_merge(events.begin(), events.begin() + existing, events.end(), more_urgent);
+    }
+
+    return imported.size();
+}
+
+const char *get_month_name(int month)
+{
+    static const char *names[] = {"January", "February", "March", "April", "May", "June",
+                                  "July", "August", "September", "October", "November", "December"};
+    return names[month - 1];
+}
+
+struct Renderer
+{
+    string frame;
+    string output;
+    vector<string> lines;
+    vector<string> previous;
+    vector<int> line_rows;
+    vector<int> previous_rows;
+    bool full_redraw = true;
+    int columns = 80;
+    int screen_rows = 24;
+    FILE *terminal = stdout;
+    size_t frames = 0;
+    size_t bytes_written = 0;
+
+    Renderer()
+    {
+        frame.reserve(16384);
+        output.reserve(16384);
+    }
+};
+
+void append_padded(string &out, const char *text, int width)
+{
+    int length = strlen(text);
+    if (length < width)
+        out.append(width - length, ' ');
+    out.append(text, length);
+}
+
+void append_number(string &out, int value, int width = 0)
+{
+    char digits[12];
+    int length = 0;
+    do
+    {
+        digits[length++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    if (length < width)
+        out.append(width - length, ' ');
+    while (length > 0)
+        out += digits[--length];
+}
+
+void display_header(string &out, int month, int year)
+{
+    out += "\033[1;36m";
+    out.append(50, '=');
+    out += "\033[0m\n\033[1;36m                       ";
+    out += get_month_name(month);
+    out += ' ';
+    append_number(out, year);
+    out += "\033[0m\n\033[1;36m";
+    out.append(50, '=');
+    out += "\033[0m\n";
+}
+
+void display_day_events(string &out, const DayList *events, const vector<int> &recurring)
+{
+    static const char *priority_colors[] = {"", "\033[1;31m", "\033[1;35m", "\033[1;34m",
+                                            "\033[1;32m", "\033[1;37m"};
+    size_t stored = events ? events->size() : 0;
+    size_t i = 0, j = 0;
+    while (i < stored || j < recurring.size())
+    {
+        bool from_rule = i == stored ||
+                         (j < recurring.size() && rules[recurring[j]].priority < event_pool[(*events)[i]].priority);
+        string_view name = from_rule ? string_view(rules[recurring[j]].name) : event_pool[(*events)[i]].name.view();
+        int priority = from_rule ? rules[recurring[j++]].priority : event_pool[(*events)[i++]].priority;
+
+        bool known = priority >= 1 && priority <= 5;
+        out += priority_colors[known ? priority : 0];
+        out += from_rule ? "  ~ " : "  * ";
+        out += name;
+        out += "\033[0m";
+    }
+}
+
+void display_calendar(string &out, int month, int year)
+{
+    display_header(out, month, year);
+
+    static const char *days[] = {"Su", "Mo", "Tu", "We", "Th", "Fr", "Sa"};
+    for (const char *d : days)
+    {
+        out += "\033[1;33m";
+        append_padded(out, d, 8);
+        out += "\033[0m";
+    }
+    out += '\n';
+
+    int start_day = weekday(days_from_civil(year, month, 1));
+    int month_length = days_in_month(month, year);
+    const MonthBucket *bucket = events_map.find_month(year, month);
+    shared_ptr<const MonthOccurrences> occurrences = expand_month(year, month);
+
+    int day_counter = 1;
+    for (int week = 0; week < 6; week++)
+    {
+
+        for (int day = 0; day < 7; day++)
+        {
+            if ((week == 0 && day < start_day) || day_counter > month_length)
+            {
+                out.append(8, ' ');
+                continue;
+            }
+
+            const DayList *events = bucket ? &bucket->days[day_counter - 1] : nullptr;
+            const vector<int> &recurring = occurrences->days[day_counter - 1];
+            bool has_events = (events && !events->empty()) || !recurring.empty();
+
+            if (has_events)
+            {
+                out += "\033[1;32m  [";
+                append_number(out, day_counter);
+                out += "]\033[0m";
+                display_day_events(out, events, recurring);
+                out.append(4, ' ');
+            }
+            else
+            {
+                append_number(out, day_counter, 4);
+                out.append(9, ' ');
+            }
+
+            day_counter++;
+        }
+        out += '\n';
+    }
+}
+
+int terminal_columns()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0)
+        return size.ws_col;
+#endif
+    return 80;
+}
+
+int terminal_rows()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0)
+        return size.ws_row;
+#endif
+    return 24;
+}
+
+int visible_width(const string &line)
+{
+    int width = 0;
+    for (size_t i = 0; i < line.size(); i++)
+    {
+        if (line[i] == '\033')
+        {
+            while (i < line.size() && !isalpha((unsigned char)line[i]))
+                i++;
+        }
+        else if (((unsigned char)line[i] & 0xc0) != 0x80)
+            width++;
+    }
+    return width;
+}
+
+void present_frame(Renderer &renderer)
+{
+    renderer.lines.clear();
+    size_t start = 0;
+    while (start <= renderer.frame.size())
+    {
+        size_t end = renderer.frame.find('\n', start);
+        if (end == string::npos)
+            end = renderer.frame.size();
+        renderer.lines.emplace_back(renderer.frame, start, end - start);
+        start = end + 1;
+    }
+
+    // Lines wider than the terminal wrap onto several rows, so each line is addressed by the row it starts on.
+    renderer.line_rows.clear();
+    int total_rows = 0;
+    for (const string &line : renderer.lines)
+    {
+        int width = visible_width(line);
+        int rows = width == 0 ? 1 : (width - 1) / renderer.columns + 1;
+        renderer.line_rows.push_back(rows);
+        total_rows += rows;
+    }
+
+    string &output = renderer.output;
+    output.clear();
+    if (renderer.full_redraw || renderer.previous.empty() || total_rows > renderer.screen_rows)
+    {
+        output += "\033[H\033[2J";
+        output += renderer.frame;
+        renderer.full_redraw = total_rows > renderer.screen_rows;
+    }
+    else
+    {
+        int last = renderer.lines.size() - 1;
+        int row = 1, previous_row = 1;
+        for (int i = 0; i < last; i++)
+        {
+            int rows = renderer.line_rows[i];
+            bool known = i < (int)renderer.previous.size();
+            if (!known || row != previous_row || rows != renderer.previous_rows[i] ||
+                renderer.lines[i] != renderer.previous[i])
+            {
+                // Clearing before writing keeps a line that exactly fills its last row intact.
+                for (int r = row + rows - 1; r >= row; r--)
+                {
+                    output += "\033[";
+                    append_number(output, r);
+                    output += ";1H\033[K";
+                }
+                output += renderer.lines[i];
+            }
+            row += rows;
+            previous_row += known ? renderer.previous_rows[i] : rows;
+        }
+
+        output += "\033[";
+        append_number(output, row);
+        output += ";1H\033[J";
+        output += renderer.lines[last];
+    }
+
+    fwrite(output.data(), 1, output.size(), renderer.terminal);
+    fflush(renderer.terminal);
+
+    renderer.previous.swap(renderer.lines);
+    renderer.previous_rows.swap(renderer.line_rows);
+    renderer.frames++;
+    renderer.bytes_written += output.size();
+}
+
+void add_event()
+{
+    Event e;
+    string date_text;
+
+    while (true)
+    {
+        cout << "Enter date (dd/mm/yyyy) : ";
+        cin >> date_text;
+        if (parse_date(date_text, e.date))
+            break;
+        cout << "\033[1;31mInvalid date!\033[0m ";
+    }
+
+    cout << "Event name: ";
+    cin.ignore();
+    string name;
+    getline(cin, name);
+    e.name = move(name);
+
+    while (true)
+    {
+        cout << "Priority (1-5, 1=highest): ";
+        cin >> e.priority;
+        if (e.priority >= 1 && e.priority <= 5)
+            break;
+        cout << "\033[1;31mInvalid priority!\033[0m ";
+    }
+
+    locked_add(interactive_journal, e);
+}
+
+int select_event(int date, const string &date_text, const char *prompt, bool allow_cancel)
+{
+    {
+        shared_lock store(store_mutex);
+        RangeReadLock months(date, date);
+        if (!events_map.contains(date))
+        {
+            cout << "\033[1;31mNo events found!\033[0m\n";
+            return -1;
+        }
+
+        const DayList &events = *events_map.find(date);
+        cout << "Events on " << date_text << ":\n";
+        for (size_t i = 0; i < events.size(); i++)
+        {
+            cout << i + 1 << ". " << event_pool[events[i]].name
+                 << " (Priority: " << event_pool[events[i]].priority << ")\n";
+        }
+    }
+
+    string text;
+    int choice;
+    cout << prompt;
+    cin >> text;
+
+    if (allow_cancel && text == "0")
+    {
+        cout << "Deletion cancelled.\n";
+        return -1;
+    }
+
+    shared_lock store(store_mutex);
+    RangeReadLock months(date, date);
+    const DayList *events = events_map.find(date);
+    if (!parse_count(text, choice) || choice < 1 || !events || choice > (int)events->size())
+    {
+        cout << "\033[1;31mInvalid selection!\033[0m\n";
+        return -1;
+    }
+    return (*events)[choice - 1];
+}
+
+// The handle may have been freed and reused in a month the caller has not locked, so it is
+// looked up in the locked day's list before the event itself is read.
+bool locate_event(int handle, int date, int &index)
+{
+    const DayList *events = events_map.find(date);
+    if (events)
+    {
+        index = find(events->begin(), events->end(), handle) - events->begin();
+        if (index < (int)events->size())
+            return true;
+    }
+
+    cout << "\033[1;31mThe event was changed by another session!\033[0m\n";
+    return false;
+}
+
+void edit_event()
+{
+    string date_text;
+    cout << "Enter event date to edit (dd/mm/yyyy): ";
+    cin >> date_text;
+
+    int date;
+    if (!parse_date(date_text, date))
+    {
+        cout << "\033[1;31mInvalid date!\033[0m\n";
+        return;
+    }
+
+    int handle = select_event(date, date_text, "Select event to edit: ", false);
+    if (handle == -1)
+        return;
+
+    string old_name;
+    int old_priority;
+    {
+        shared_lock store(store_mutex);
+        RangeReadLock months(date, date);
+        int index;
+        if (!locate_event(handle, date, index))
+            return;
+        old_name = event_pool[handle].name;
+        old_priority = event_pool[handle].priority;
+    }
+
+    cout << "New name (" << old_name << "): ";
+    cin.ignore();
+    string name;
+    getline(cin, name);
+    if (name.empty())
+        name = old_name;
+
+    int priority = old_priority;
+    while (true)
+    {
+        cout << "New priority (" << old_priority << "): ";
+        string prio;
+        getline(cin, prio);
+        if (prio.empty() || (parse_count(prio, priority) && priority >= 1 && priority <= 5))
+            break;
+        priority = old_priority;
+        cout << "\033[1;31mInvalid priority!\033[0m ";
+    }
+
+    DayWriteLock lock(date);
+    int index;
+    if (locate_event(handle, date, index))
+        journal_edit(interactive_journal, date, index, name, priority);
+}
+
+void delete_event()
+{
+    string date_text;
+    cout << "Enter event date to delete from (dd/mm/yyyy): ";
+    cin >> date_text;
+
+    int date;
+    if (!parse_date(date_text, date))
+    {
+        cout << "\033[1;31mInvalid date!\033[0m\n";
+        return;
+    }
+
+    int handle = select_event(date, date_text, "Select event to delete (0 to cancel): ", true);
+    if (handle == -1)
+        return;
+
+    {
+        DayWriteLock lock(date);
+        int index;
+        if (!locate_event(handle, date, index))
+            return;
+        journal_delete(interactive_journal, date, index);
+    }
+
+    cout << "\033[1;32mEvent deleted successfully!\033[0m\n";
+}
+
+void recur_events()
+{
+    {
+        shared_lock lock(store_mutex);
+        cout << "\nRecurring events:\n";
+        for (size_t i = 0; i < rules.size(); i++)
+            cout << i + 1 << ". " << describe_rule(rules[i]) << "\n";
+        if (rules.empty())
+            cout << "\033[1;31mNo recurring events.\033[0m\n";
+    }
+
+    cout << "\033[1;35m[A]\033[0mdd \033[1;31m[D]\033[0melete e\033[1;33m[X]\033[0mception \033[1;36m[B]\033[0mack\n> ";
+    char choice;
+    cin >> choice;
+    choice = tolower(choice);
+
+    string text;
+    if (choice == 'a')
+    {
+        RecurrenceRule rule;
+        while (true)
+        {
+            cout << "First date (dd/mm/yyyy) : ";
+            cin >> text;
+            if (parse_date(text, rule.start))
+                break;
+            cout << "\033[1;31mInvalid date!\033[0m ";
+        }
+        while (true)
+        {
+            cout << "Repeat (d=daily, w=weekly, m=monthly, y=yearly): ";
+            cin >> text;
+            if (text.size() == 1 && parse_frequency(text[0], rule.frequency))
+                break;
+            cout << "\033[1;31mInvalid frequency!\033[0m ";
+        }
+        while (true)
+        {
+            cout << "Every how many (1 = every time): ";
+            cin >> text;
+            if (parse_count(text, rule.interval) && rule.interval >= 1 && rule.interval <= MAX_INTERVAL)
+                break;
+            cout << "\033[1;31mInvalid interval!\033[0m ";
+        }
+        while (true)
+        {
+            cout << "Number of times (0 = forever): ";
+            cin >> text;
+            if (parse_count(text, rule.count))
+                break;
+            cout << "\033[1;31mInvalid count!\033[0m ";
+        }
+        while (true)
+        {
+            cout << "Last date (dd/mm/yyyy, - for none): ";
+            cin >> text;
+            if (text == "-" || parse_date(text, rule.until))
+                break;
+            cout << "\033[1;31mInvalid date!\033[0m ";
+        }
+
+        cout << "Event name: ";
+        cin.ignore();
+        getline(cin, rule.name);
+
+        while (true)
+        {
+            cout << "Priority (1-5, 1=highest): ";
+            cin >> text;
+            if (parse_count(text, rule.priority) && rule.priority >= 1 && rule.priority <= 5)
+                break;
+            cout << "\033[1;31mInvalid priority!\033[0m ";
+        }
+
+        unique_lock lock(store_mutex);
+        add_rule(rule);
+    }
+    else if (choice == 'd' || choice == 'x')
+    {
+        int index;
+        cout << "Select recurring event: ";
+        cin >> text;
+        if (!parse_count(text, index) || index < 1)
+        {
+            cout << "\033[1;31mInvalid selection!\033[0m\n";
+            return;
+        }
+
+        int date = 0;
+        if (choice == 'x')
+        {
+            cout << "Date to skip (dd/mm/yyyy): ";
+            cin >> text;
+            if (!parse_date(text, date))
+            {
+                cout << "\033[1;31mInvalid date!\033[0m\n";
+                return;
+            }
+        }
+
+        unique_lock lock(store_mutex);
+        if (index > (int)rules.size())
+        {
+            cout << "\033[1;31mInvalid selection!\033[0m\n";
+            return;
+        }
+
+        if (choice == 'd')
+            remove_rule(index - 1);
+        else
+            add_rule_exception(index - 1, date);
+    }
+}
+
+void urgent_events()
+{
+    int today = calendar_today();
+    {
+        shared_lock store(store_mutex);
+        RangeReadLock months(today, today + 30);
+        vector<int> urgent = most_urgent(today, today + 30, 10);
+
+        cout << "\nMost urgent events in the next 30 days:\n";
+        for (int handle : urgent)
+        {
+            const Event &event = event_pool[handle];
+            cout << format_date(event.date) << "  " << event.name
+                 << " (Priority: " << event.priority << ")\n";
+        }
+
+        if (urgent.empty())
+        {
+            cout << "\033[1;31mNo upcoming events.\033[0m\n";
+        }
+    }
+
+    cout << "\033[1;32mPress Enter to continue...\033[0m";
+    cin.ignore();
+    cin.get();
+}
+
+void cleanup_events()
+{
+    int today = calendar_today();
+
+    cleanup_touched = 0;
+    if (today <= expiry_watermark)
+        return;
+
+    // Only the stripe of the day being expired is taken, so readers and writers of other months
+    // carry on. A writer that links onto the day before its stripe is taken is expired with it.
+    while (true)
+    {
+        int date;
+        {
+            lock_guard<mutex> lock(expiry_mutex);
+            if (expiry_dates.empty() || expiry_dates.top() >= today)
+            {
+                expiry_watermark = max(expiry_watermark.load(), today);
+                break;
+            }
+            date = expiry_dates.top();
+            expiry_dates.pop();
+        }
+
+        shared_lock store(store_mutex);
+        unique_lock month_lock(month_stripes[month_stripe(date)]);
+        int year, month, day;
+        civil_from_days(date, year, month, day);
+        MonthBucket &bucket = events_map.get_month(year, month);
+        bucket.scheduled &= ~(1u << (day - 1));
+        for (int handle : bucket.days[day - 1])
+        {
+            event_pool[handle].expired = true;
+            cleanup_touched++;
+        }
+    }
+    count_cleanup(cleanup_touched);
+}
+
+struct ExpiryScheduler
+{
+    thread worker;
+    mutex wake_mutex;
+    condition_variable wake;
+    condition_variable finished;
+    bool stopping = false;
+    bool poked = false;
+    bool running = false;
+    long runs = 0;
+
+    void run()
+    {
+        unique_lock<mutex> lock(wake_mutex);
+        while (true)
+        {
+            wake.wait_until(lock, next_midnight(), [this]
+                            { return stopping || poked; });
+            if (stopping)
+                break;
+
+            poked = false;
+            running = true;
+            lock.unlock();
+            cleanup_events();
+            lock.lock();
+            running = false;
+            runs++;
+            finished.notify_all();
+        }
+    }
+
+    void start()
+    {
+        stopping = false;
+        worker = thread(&ExpiryScheduler::run, this);
+    }
+
+    void stop()
+    {
+        if (!worker.joinable())
+            return;
+
+        {
+            lock_guard<mutex> lock(wake_mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    void poke_and_wait()
+    {
+        if (!worker.joinable())
+        {
+            cleanup_events();
+            return;
+        }
+
+        unique_lock<mutex> lock(wake_mutex);
+        long target = runs + (running ? 2 : 1);
+        poked = true;
+        wake.notify_one();
+        finished.wait(lock, [&]
+                      { return runs >= target || stopping; });
+    }
+};
+
+ExpiryScheduler expiry_scheduler;
+
+#if defined(CALENDAR_BENCH) || defined(CALENDAR_TEST)
+void set_fake_today(int date)
+{
+    fake_today = date;
+    expiry_scheduler.poke_and_wait();
+}
+#endif
+
+string next_token(const string &line, size_t &position)
+{
+    while (position < line.size() && line[position] == ' ')
+        position++;
+    size_t start = position;
+    while (position < line.size() && line[position] != ' ')
+        position++;
+    return line.substr(start, position - start);
+}
+
+string rest_of_line(const string &line, size_t position)
+{
+    while (position < line.size() && line[position] == ' ')
+        position++;
+    return line.substr(position);
+}
+
+bool parse_priority(const string &text, int &priority)
+{
+    if (text.size() != 1 || text[0] < '1' || text[0] > '5')
+        return false;
+    priority = text[0] - '0';
+    return true;
+}
+
+bool parse_index(const string &text, int date, int &index)
+{
+    if (!parse_count(text, index))
+        return false;
+    index--;
+
+    const DayList *events = events_map.find(date);
+    return events && index >= 0 && index < (int)events->size();
+}
+
+void append_event(string &out, int handle)
+{
+    const Event &event = event_pool[handle];
+    out += "EVENT ";
+    out += format_date(event.date);
+    out += ' ';
+    append_number(out, event.priority);
+    out += ' ';
+    out += event.expired ? "expired" : "active";
+    out += ' ';
+    out += event.name;
+    out += '\n';
+}
+
+void append_occurrence(string &out, int rule, int date)
+{
+    out += "EVENT ";
+    out += format_date(date);
+    out += ' ';
+    append_number(out, rules[rule].priority);
+    out += date < calendar_today() ? " expired " : " active ";
+    out += rules[rule].name;
+    out += '\n';
+}
+
+bool parse_filter(const string &line, size_t &position, EventFilter &filter)
+{
+    for (string token = next_token(line, position); !token.empty(); token = next_token(line, position))
+    {
+        if (token == "active")
+            filter.status = ACTIVE_ONLY;
+        else if (token == "expired")
+            filter.status = EXPIRED_ONLY;
+        else
+        {
+            size_t dash = token.find('-');
+            string low = token.substr(0, dash);
+            string high = dash == string::npos ? low : token.substr(dash + 1);
+            if (!parse_priority(low, filter.min_priority) || !parse_priority(high, filter.max_priority) ||
+                filter.min_priority > filter.max_priority)
+                return false;
+        }
+    }
+    return true;
+}
+
+void append_count(string &out, int count)
+{
+    out += "OK ";
+    append_number(out, count);
+    out += '\n';
+}
+
+void run_command(const string &line, string &out, Journal &journal)
+{
+    size_t position = 0;
+    string command = next_token(line, position);
+    int date, to, priority, index;
+
+    if (command.empty())
+        return;
+
+#if defined(CALENDAR_BENCH) || defined(CALENDAR_TEST)
+    if (command == "TODAY")
+    {
+        if (!parse_date(next_token(line, position), date))
+        {
+            out += "ERR usage: TODAY dd/mm/yyyy\n";
+            return;
+        }
+        set_fake_today(date);
+        out += "OK\n";
+        return;
+    }
+#endif
+
+    if (command == "ADD")
+    {
+        Event e;
+        if (!parse_date(next_token(line, position), e.date) ||
+            !parse_priority(next_token(line, position), e.priority))
+        {
+            out += "ERR usage: ADD dd/mm/yyyy priority name\n";
+            return;
+        }
+        e.name = rest_of_line(line, position);
+        locked_add(journal, e);
+        out += "OK\n";
+    }
+    else if (command == "EDIT")
+    {
+        const char *usage = "ERR usage: EDIT dd/mm/yyyy index priority [name]\n";
+        if (!parse_date(next_token(line, position), date))
+        {
+            out += usage;
+            return;
+        }
+        DayWriteLock lock(date);
+        if (!parse_index(next_token(line, position), date, index) ||
+            !parse_priority(next_token(line, position), priority))
+        {
+            out += usage;
+            return;
+        }
+        string name = rest_of_line(line, position);
+        if (name.empty())
+            name = event_pool[events_map.get(date)[index]].name;
+        journal_edit(journal, date, index, name, priority);
+        out += "OK\n";
+    }
+    else if (command == "DEL")
+    {
+        const char *usage = "ERR usage: DEL dd/mm/yyyy index\n";
+        if (!parse_date(next_token(line, position), date))
+        {
+            out += usage;
+            return;
+        }
+        DayWriteLock lock(date);
+        if (!parse_index(next_token(line, position), date, index))
+        {
+            out += usage;
+            return;
+        }
+        journal_delete(journal, date, index);
+        out += "OK\n";
+    }
+    else if (command == "UNDO" || command == "REDO")
+    {
+        unique_lock lock(store_mutex);
+        bool undo = command == "UNDO";
+        StepResult result = undo ? undo_operation(journal) : redo_operation(journal);
+        if (result == STEP_DONE)
+            out += "OK\n";
+        else if (result == STEP_CONFLICT)
+            out += "ERR conflict\n";
+        else
+            out += undo ? "ERR nothing to undo\n" : "ERR nothing to redo\n";
+    }
+    else if (command == "GET")
+    {
+        if (!parse_date(next_token(line, position), date))
+        {
+            out += "ERR usage: GET dd/mm/yyyy\n";
+            return;
+        }
+        shared_lock store(store_mutex);
+        RangeReadLock months(date, date);
+        const DayList *events = events_map.find(date);
+        int count = events ? events->size() : 0;
+        for (int i = 0; i < count; i++)
+            append_event(out, (*events)[i]);
+        append_count(out, count);
+    }
+    else if (command == "RANGE")
+    {
+        EventFilter filter;
+        if (!parse_date(next_token(line, position), date) ||
+            !parse_date(next_token(line, position), to) || to < date ||
+            !parse_filter(line, position, filter))
+        {
+            out += "ERR usage: RANGE dd/mm/yyyy dd/mm/yyyy [priority[-priority]] [active|expired]\n";
+            return;
+        }
+        shared_lock store(store_mutex);
+        RangeReadLock months(date, to);
+        int count = 0;
+        for_each_entry(date, to, filter,
+                       [&](int handle)
+                       {
+                           append_event(out, handle);
+                           count++;
+                       },
+                       [&](int rule, int day)
+                       {
+                           append_occurrence(out, rule, day);
+                           count++;
+                       });
+        append_count(out, count);
+    }
+    else if (command == "COUNT")
+    {
+        EventFilter filter;
+        const char periods[] = "dwm";
+        string unit = next_token(line, position);
+        const char *period = unit.size() == 1 && unit[0] ? strchr(periods, unit[0]) : nullptr;
+        if (!period || !parse_date(next_token(line, position), date) ||
+            !parse_date(next_token(line, position), to) || to < date ||
+            !parse_filter(line, position, filter))
+        {
+            out += "ERR usage: COUNT d|w|m dd/mm/yyyy dd/mm/yyyy [priority[-priority]] [active|expired]\n";
+            return;
+        }
+        shared_lock store(store_mutex);
+        RangeReadLock months(date, to);
+        static thread_local vector<int> counts;
+        int total = 0;
+        count_events(date, to, filter, period - periods, counts);
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            if (!counts[i])
+                continue;
+            out += "COUNT ";
+            out += format_date(period_start(date, i, period - periods));
+            out += ' ';
+            append_number(out, counts[i]);
+            out += '\n';
+            total += counts[i];
+        }
+        append_count(out, total);
+    }
+    else if (command == "RULE")
+    {
+        RecurrenceRule rule;
+        string start = next_token(line, position);
+        string frequency = next_token(line, position);
+        string interval = next_token(line, position);
+        string count = next_token(line, position);
+        string until = next_token(line, position);
+        if (!parse_date(start, rule.start) || frequency.size() != 1 ||
+            !parse_frequency(frequency[0], rule.frequency) ||
+            !parse_count(interval, rule.interval) || rule.interval < 1 || rule.interval > MAX_INTERVAL ||
+            !parse_count(count, rule.count) ||
+            (until != "-" && !parse_date(until, rule.until)) ||
+            !parse_priority(next_token(line, position), rule.priority))
+        {
+            out += "ERR usage: RULE dd/mm/yyyy d|w|m|y interval count until|- priority name\n";
+            return;
+        }
+        rule.name = rest_of_line(line, position);
+        unique_lock lock(store_mutex);
+        add_rule(rule);
+        out += "OK\n";
+    }
+    else if (command == "RULEDEL")
+    {
+        unique_lock lock(store_mutex);
+        if (!parse_count(next_token(line, position), index) || index < 1 || index > (int)rules.size())
+        {
+            out += "ERR usage: RULEDEL index\n";
+            return;
+        }
+        remove_rule(index - 1);
+        out += "OK\n";
+    }
+    else if (command == "EXCEPT")
+    {
+        unique_lock lock(store_mutex);
+        if (!parse_count(next_token(line, position), index) || index < 1 || index > (int)rules.size() ||
+            !parse_date(next_token(line, position), date))
+        {
+            out += "ERR usage: EXCEPT index dd/mm/yyyy\n";
+            return;
+        }
+        add_rule_exception(index - 1, date);
+        out += "OK\n";
+    }
+    else if (command == "RULES")
+    {
+        shared_lock lock(store_mutex);
+        for (const auto &rule : rules)
+        {
+            out += "RULE ";
+            out += describe_rule(rule);
+            out += '\n';
+        }
+        append_count(out, rules.size());
+    }
+    else
+        out += "ERR unknown command\n";
+}
+
+bool read_chunk(int input, string &pending)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    char buffer[65536];
+    ssize_t received = read(input, buffer, sizeof(buffer));
+    if (received <= 0)
+        return false;
+    pending.append(buffer, received);
+    return true;
+#else
+    string line;
+    if (!getline(cin, line))
+        return false;
+    pending += line;
+    pending += '\n';
+    return true;
+#endif
+}
+
+void write_output(int output, string &out)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    size_t written = 0;
+    while (written < out.size())
+    {
+        ssize_t sent = write(output, out.data() + written, out.size() - written);
+        if (sent <= 0)
+            break;
+        written += sent;
+    }
+#else
+    cout.write(out.data(), out.size());
+    cout.flush();
+#endif
+    out.clear();
+}
+
+void run_batch(string &pending, string &out, int output, Journal &journal)
+{
+    size_t start = 0, end;
+    while ((end = pending.find('\n', start)) != string::npos)
+    {
+        string line = pending.substr(start, end - start);
+        start = end + 1;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if (line == "FLUSH")
+            write_output(output, out);
+        else
+            run_command(line, out, journal);
+    }
+    pending.erase(0, start);
+
+    flush_log();
+    write_output(output, out);
+}
+
+void serve(int input, int output)
+{
+    string pending, out;
+    Journal journal;
+    while (read_chunk(input, pending))
+        run_batch(pending, out, output, journal);
+
+    if (!pending.empty())
+    {
+        pending += '\n';
+        run_batch(pending, out, output, journal);
+    }
+
+    unique_lock lock(store_mutex);
+    clear_journal(journal);
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+int serve_socket(const char *path)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        cerr << "Socket path is too long: " << path << "\n";
+        return 1;
+    }
+    strcpy(address.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (listener < 0 || bind(listener, (sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listener, 16) != 0)
+    {
+        cerr << "Could not listen on " << path << "\n";
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    while (true)
+    {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0)
+            continue;
+
+        thread([client]
+               {
+                   serve(client, client);
+                   close(client);
+               })
+            .detach();
+    }
+}
+#endif
+
+#if defined(CALENDAR_BENCH)
+struct BenchConfig
+{
+    int events = 100000;
+    int start = days_from_civil(2026, 1, 1);
+    int days = 3 * 365;
+    double skew = 0;
+    double mix[5] = {1, 1, 1, 1, 1};
+    int queries = 10000;
+    unsigned seed = 1;
+};
+
+struct BenchResult
+{
+    string name;
+    long long ops;
+    double ns_per_op;
+    double allocations_per_op;
+    double bytes_per_op = -1;
+    double p50_ns = -1;
+    double p99_ns = -1;
+    long long memory_bytes = -1;
+};
+
+long long bench_sink = 0;
+
+bool parse_bench_option(const string &option, BenchConfig &config)
+{
+    size_t equals = option.find('=');
+    if (equals == string::npos)
+        return false;
+
+    string key = option.substr(0, equals);
+    string value = option.substr(equals + 1);
+    try
+    {
+        if (key == "events")
+            config.events = stoi(value);
+        else if (key == "days")
+            config.days = stoi(value);
+        else if (key == "skew")
+            config.skew = stod(value);
+        else if (key == "queries")
+            config.queries = stoi(value);
+        else if (key == "seed")
+            config.seed = stoul(value);
+        else if (key == "mix")
+        {
+            istringstream weights(value);
+            string weight;
+            double total = 0;
+            int count = 0;
+            while (count < 5 && getline(weights, weight, ','))
+            {
+                config.mix[count] = stod(weight);
+                if (config.mix[count] < 0)
+                    return false;
+                total += config.mix[count++];
+            }
+            if (count != 5 || !weights.eof() || total <= 0)
+                return false;
+        }
+        else
+            return false;
+    }
+    catch (...)
+    {
+        return false;
+    }
+    return config.events > 0 && config.days > 0 && config.skew >= 0 && config.skew < 1 && config.queries > 0;
+}
+
+vector<Event> generate_events(const BenchConfig &config, mt19937 &random)
+{
+    static const char *words[] = {"meeting", "review", "lunch", "deadline",
+                                  "call", "standup", "dentist", "report"};
+    uniform_real_distribution<double> unit(0, 1);
+    uniform_int_distribution<int> word(0, 7);
+    discrete_distribution<int> priority(config.mix, config.mix + 5);
+    double exponent = 1 / (1 - config.skew);
+
+    vector<Event> events(config.events);
+    for (int i = 0; i < config.events; i++)
+    {
+        Event &e = events[i];
+        e.date = config.start + min(config.days - 1, (int)(pow(unit(random), exponent) * config.days));
+        e.priority = priority(random) + 1;
+        e.name = words[word(random)] + (' ' + to_string(i));
+    }
+    return events;
+}
+
+template <typename Run>
+void bench_run(vector<BenchResult> &results, const string &name, Run run)
+{
+    long long allocations = bench_counters.allocations;
+    auto started = chrono::steady_clock::now();
+    long long ops = run();
+    double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - started).count();
+    allocations = bench_counters.allocations - allocations;
+    ops = max(ops, 1LL);
+    results.push_back({name, ops, elapsed / ops, (double)allocations / ops});
+}
+
+long long peak_rss_kb()
+{
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+template <typename Run>
+void bench_isolated(vector<BenchResult> &results, Run run)
+{
+#if defined(__unix__) || defined(__APPLE__)
+    int channel[2];
+    if (pipe(channel) != 0)
+        return;
+
+    cout.flush();
+    pid_t child = fork();
+    if (child == 0)
+    {
+        close(channel[0]);
+        vector<BenchResult> measured;
+        run(measured);
+        string report;
+        for (const BenchResult &result : measured)
+        {
+            report += result.name + ' ' + to_string(result.ops) + ' ' + to_string(result.ns_per_op) + ' ' +
+                      to_string(result.allocations_per_op) + ' ' + to_string(result.memory_bytes) + '\n';
+        }
+        write_output(channel[1], report);
+        _exit(0);
+    }
+
+    close(channel[1]);
+    string report;
+    while (child > 0 && read_chunk(channel[0], report))
+    {
+    }
+    close(channel[0]);
+    if (child > 0)
+        waitpid(child, nullptr, 0);
+
+    istringstream lines(report);
+    BenchResult result;
+    while (lines >> result.name >> result.ops >> result.ns_per_op >> result.allocations_per_op >> result.memory_bytes)
+        results.push_back(result);
+#else
+    run(results);
+#endif
+}
+
+template <typename Store>
+void bench_storage(vector<BenchResult> &results, const string &name, const vector<Event> &generated,
+                   const vector<int> &dates)
+{
+    bench_isolated(results, [&](vector<BenchResult> &measured)
+                   {
+                       Store store;
+                       long long before = peak_rss_kb();
+                       bench_run(measured, name + "_add", [&]
+                                 {
+                                     for (const Event &e : generated)
+                                         store.add(e);
+                                     return generated.size();
+                                 });
+                       measured.back().memory_bytes = (peak_rss_kb() - before) * 1024;
+
+                       bench_run(measured, name + "_edit", [&]
+                                 {
+                                     long long edits = 0;
+                                     for (size_t i = 0; i < dates.size(); i++)
+                                         edits += store.edit(dates[i], "edited " + to_string(i), i % 5 + 1);
+                                     return edits;
+                                 });
+                       bench_run(measured, name + "_delete", [&]
+                                 {
+                                     long long deletes = 0;
+                                     for (int date : dates)
+                                         deletes += store.remove(date);
+                                     return deletes;
+                                 });
+                   });
+}
+
+struct PooledStore
+{
+    Pool<Event> pool;
+    unordered_map<int, vector<int>> days;
+
+    void add(const Event &e)
+    {
+        int handle = pool.create(e);
+        vector<int> &day = days[e.date];
+        day.insert(upper_bound(day.begin(), day.end(), handle, [&](int a, int b)
+                               { return pool[a].priority < pool[b].priority; }),
+                   handle);
+    }
 
-using namespace std;
+    bool edit(int date, const string &name, int priority)
+    {
+        auto found = days.find(date);
+        if (found == days.end() || found->second.empty())
+            return false;
+        vector<int> &day = found->second;
+        int handle = day[0];
+        pool[handle].name = name;
+        pool[handle].priority = priority;
+        day.erase(day.begin());
+        day.insert(upper_bound(day.begin(), day.end(), handle, [&](int a, int b)
+                               { return pool[a].priority < pool[b].priority; }),
+                   handle);
+        return true;
+    }
 
-struct Event
+    bool remove(int date)
+    {
+        auto found = days.find(date);
+        if (found == days.end() || found->second.empty())
+            return false;
+        pool.release(found->second[0]);
+        found->second.erase(found->second.begin());
+        return true;
+    }
+};
+
+struct DirectStore
 {
-    string date;
-    string name;
-    int priority;
-    string status = "active";
+    unordered_map<int, vector<Event>> days;
+
+    static bool more_urgent_event(const Event &a, const Event &b)
+    {
+        return a.priority < b.priority;
+    }
+
+    void add(const Event &e)
+    {
+        vector<Event> &day = days[e.date];
+        day.insert(upper_bound(day.begin(), day.end(), e, more_urgent_event), e);
+    }
 
-    bool operator<(const Event &other) const
+    bool edit(int date, const string &name, int priority)
     {
-        return priority > other.priority;
+        auto found = days.find(date);
+        if (found == days.end() || found->second.empty())
+            return false;
+        vector<Event> &day = found->second;
+        Event edited = day[0];
+        edited.name = name;
+        edited.priority = priority;
+        day.erase(day.begin());
+        day.insert(upper_bound(day.begin(), day.end(), edited, more_urgent_event), edited);
+        return true;
+    }
+
+    bool remove(int date)
+    {
+        auto found = days.find(date);
+        if (found == days.end() || found->second.empty())
+            return false;
+        found->second.erase(found->second.begin());
+        return true;
     }
 };
 
-struct HashTable
+void bench_present(vector<BenchResult> &results, const BenchConfig &config)
 {
-    static const int TABLE_SIZE = 31;
-    vector<Event> table[TABLE_SIZE];
+    Renderer renderer;
+#if defined(_WIN32)
+    renderer.terminal = fopen("NUL", "w");
+#else
+    renderer.terminal = fopen("/dev/null", "w");
+#endif
+    if (!renderer.terminal)
+        return;
 
-    int hash(const string &date)
+    int year, month, day;
+    civil_from_days(config.start, year, month, day);
+    int first_key = HashTable::month_key(year, month);
+    int months = min(config.days / 28 + 1, 120);
+    auto present_month = [&](int key)
     {
+        renderer.frame.clear();
+        display_calendar(renderer.frame, key % 12 + 1, key / 12);
+        renderer.frame += "\nOptions:\n> ";
+        present_frame(renderer);
+    };
 
-        int day = stoi(date.substr(0, 2));
-        int month = stoi(date.substr(3, 2));
-        int year = stoi(date.substr(6, 4));
+    struct
+    {
+        const char *name;
+        bool navigate;
+        int columns;
+    } cases[] = {{"present_navigate", true, INT_MAX},
+                 {"present_unchanged", false, INT_MAX},
+                 {"present_wrapped", false, 80},
+                 {"present_wrapped_navigate", true, 80}};
+    renderer.screen_rows = INT_MAX;
+    for (const auto &test : cases)
+    {
+        renderer.columns = test.columns;
+        renderer.full_redraw = true;
+        renderer.frames = 0;
+        renderer.bytes_written = 0;
+        bench_run(results, test.name, [&]
+                  {
+                      for (int i = 0; i < months; i++)
+                          present_month(first_key + (test.navigate ? i : 0));
+                      return months;
+                  });
+        results.back().bytes_per_op = (double)renderer.bytes_written / renderer.frames;
+    }
+    fclose(renderer.terminal);
+}
 
-        return ((day * 31 + month) * 31 + year) % TABLE_SIZE;
+void bench_scaling(vector<BenchResult> &results, const vector<int> &dates)
+{
+    vector<string> commands;
+    for (size_t i = 0; i < dates.size(); i++)
+    {
+        string date = format_date(dates[i]);
+        if (i % 16 == 15)
+            commands.push_back("EDIT " + date + " 1 " + to_string(i % 5 + 1));
+        else if (i % 2)
+            commands.push_back("GET " + date);
+        else
+            commands.push_back("COUNT d " + date + " " + format_date(dates[i] + 30));
     }
 
-    void insert(const Event &event)
+    int cores = max(1u, thread::hardware_concurrency());
+    for (int threads = 1;; threads = min(threads * 2, cores))
     {
-        int index = hash(event.date);
+        bench_run(results, "scaling_" + to_string(threads) + "_threads", [&]
+                  {
+                      vector<thread> workers;
+                      for (int t = 0; t < threads; t++)
+                      {
+                          workers.emplace_back([&commands, t]
+                                               {
+                                                   string out;
+                                                   Journal journal;
+                                                   for (size_t i = 0; i < commands.size(); i++)
+                                                   {
+                                                       run_command(commands[(i + t * 7919) % commands.size()], out, journal);
+                                                       out.clear();
+                                                   }
+                                               });
+                      }
+                      for (thread &worker : workers)
+                          worker.join();
+                      return (long long)threads * commands.size();
+                  });
+        if (threads == cores)
+            break;
+    }
+}
 
-        for (const auto &e : table[index])
-        {
-            if (e.date == event.date && e.name == event.name)
-            {
-                return;
-            }
-        }
-        table[index].push_back(event);
+// Each writer edits only its own months, so with per-month stripes they should not wait on
+// each other.
+void bench_writers(vector<BenchResult> &results, const vector<int> &dates)
+{
+    int cores = max(1u, thread::hardware_concurrency());
+    vector<vector<string>> commands(cores);
+    for (size_t i = 0; i < dates.size(); i++)
+    {
+        int year, month, day;
+        civil_from_days(dates[i], year, month, day);
+        commands[HashTable::month_key(year, month) % cores].push_back(
+            "EDIT " + format_date(dates[i]) + " 1 " + to_string(i % 5 + 1));
     }
 
-    vector<Event> &get(const string &date)
+    bench_run(results, "writers_" + to_string(cores) + "_threads", [&]
+              {
+                  vector<thread> workers;
+                  for (int t = 0; t < cores; t++)
+                  {
+                      workers.emplace_back([&commands, t]
+                                           {
+                                               string out;
+                                               Journal journal;
+                                               for (const string &command : commands[t])
+                                               {
+                                                   run_command(command, out, journal);
+                                                   out.clear();
+                                               }
+                                           });
+                  }
+                  for (thread &worker : workers)
+                      worker.join();
+                  return (long long)dates.size();
+              });
+}
+
+// GET latency for a month that cleanup leaves alone, measured while cleanup expires every
+// earlier day.
+void bench_cleanup_readers(vector<BenchResult> &results, const BenchConfig &config)
+{
+    int year, month, day;
+    civil_from_days(config.start + config.days - 1, year, month, day);
+    int today = days_from_civil(year, month, 1);
+
+    atomic<bool> started{false}, done{false};
+    vector<double> latencies;
+    thread reader([&]
+                  {
+                      string out;
+                      Journal journal;
+                      vector<string> commands;
+                      for (int date = today; date < today + days_in_month(month, year); date++)
+                          commands.push_back("GET " + format_date(date));
+                      started = true;
+                      for (size_t i = 0; !done; i++)
+                      {
+                          auto started = chrono::steady_clock::now();
+                          run_command(commands[i % commands.size()], out, journal);
+                          latencies.push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - started).count());
+                          out.clear();
+                      }
+                  });
+
+    while (!started)
+        this_thread::yield();
+    bench_run(results, "cleanup_readers", [&]
+              {
+                  set_fake_today(today);
+                  done = true;
+                  reader.join();
+                  return (long long)latencies.size();
+              });
+
+    sort(latencies.begin(), latencies.end());
+    if (!latencies.empty())
     {
-        return table[hash(date)];
+        results.back().p50_ns = latencies[latencies.size() / 2];
+        results.back().p99_ns = latencies[min(latencies.size() - 1, latencies.size() * 99 / 100)];
     }
+}
 
-    bool contains(const string &date)
+void bench_rules(vector<BenchResult> &results, const BenchConfig &config, mt19937 &random)
+{
+    const int count = 10000;
+    uniform_int_distribution<int> any_day(config.start, config.start + config.days - 1);
+    for (int i = 0; i < count; i++)
     {
-        int index = hash(date);
-        for (const auto &e : table[index])
+        RecurrenceRule rule;
+        rule.start = any_day(random);
+        rule.frequency = i % 4;
+        rule.interval = i % 3 + 1;
+        rule.priority = i % 5 + 1;
+        rule.name = "rule " + to_string(i);
+        rules.push_back(rule);
+    }
+    occurrence_cache.clear();
+
+    int year, month, day;
+    civil_from_days(config.start, year, month, day);
+    int first_key = HashTable::month_key(year, month);
+    int months = min(config.days / 28 + 1, (int)OCCURRENCE_CACHE_MONTHS);
+    string frame;
+    for (int pass = 0; pass < 2; pass++)
+    {
+        bench_run(results, pass == 0 ? "render_rules_cold" : "render_rules_cached", [&]
+                  {
+                      for (int i = 0; i < months; i++)
+                      {
+                          frame.clear();
+                          display_calendar(frame, (first_key + i) % 12 + 1, (first_key + i) / 12);
+                          bench_sink += frame.size();
+                      }
+                      return months;
+                  });
+    }
+
+    long long memory = rules.capacity() * sizeof(RecurrenceRule);
+    for (const auto &cached : occurrence_cache)
+    {
+        memory += sizeof(MonthOccurrences);
+        for (const auto &occurrences : cached.second->days)
+            memory += occurrences.capacity() * sizeof(int);
+    }
+    results.back().memory_bytes = memory;
+
+    rules.clear();
+    occurrence_cache.clear();
+}
+
+void bench_journal(vector<BenchResult> &results, const BenchConfig &config)
+{
+    Journal journal;
+    bench_run(results, "journal_record", [&]
+              {
+                  int handles = event_pool.items.size();
+                  for (int i = 0; i < config.queries; i++)
+                  {
+                      const Event &event = event_pool[i % handles];
+                      record_operation(journal, JOURNAL_EDIT, i % handles, event.priority, event.name, event.stamp);
+                  }
+                  return config.queries;
+              });
+    clear_journal(journal);
+}
+
+void bench_clear_store()
+{
+    events_map = HashTable();
+    event_pool = Pool<Event>();
+    expiry_dates = {};
+    expiry_watermark = INT_MIN;
+    interactive_journal = Journal();
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+bool read_response(int input, string &pending)
+{
+    size_t start = 0;
+    while (true)
+    {
+        size_t end;
+        while ((end = pending.find('\n', start)) != string::npos)
         {
-            if (e.date == date)
+            bool last = pending.compare(start, 6, "EVENT ") != 0;
+            start = end + 1;
+            if (last)
             {
+                pending.erase(0, start);
                 return true;
             }
         }
-        return false;
+        if (!read_chunk(input, pending))
+            return false;
     }
+}
 
-    void clear()
+int connect_socket(const string &path)
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path.c_str());
+    for (int attempt = 0; attempt < 100; attempt++)
     {
-        for (int i = 0; i < TABLE_SIZE; i++)
-        {
-            table[i].clear();
-        }
+        int client = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (client >= 0 && connect(client, (sockaddr *)&address, sizeof(address)) == 0)
+            return client;
+        if (client >= 0)
+            close(client);
+        this_thread::sleep_for(chrono::milliseconds(10));
     }
-};
-
-HashTable events_map;
+    return -1;
+}
 
-bool validate_date(const string &date)
+void bench_socket(vector<BenchResult> &results, const BenchConfig &config, const vector<int> &dates)
 {
-    if (date.size() != 10 || date[2] != '/' || date[5] != '/')
-        return false;
+    string path = "/tmp/calendar-bench-" + to_string(getpid()) + ".sock";
+    thread([path]
+           { serve_socket(path.c_str()); })
+        .detach();
+    int probe = connect_socket(path);
+    if (probe < 0)
+        return;
+    close(probe);
 
-    try
-    {
-        int day = stoi(date.substr(0, 2));
-        int month = stoi(date.substr(3, 2));
-        int year = stoi(date.substr(6, 4));
+    const int clients = 4;
+    int requests = max(1, min(config.queries, 20000) / clients);
+    vector<vector<double>> latencies(clients);
+    bench_run(results, "socket_get", [&]
+              {
+                  vector<thread> workers;
+                  for (int c = 0; c < clients; c++)
+                  {
+                      workers.emplace_back([&, c]
+                                           {
+                                               int client = connect_socket(path);
+                                               string pending, request;
+                                               for (int i = 0; client >= 0 && i < requests; i++)
+                                               {
+                                                   request = "GET " + format_date(dates[(i * clients + c) % dates.size()]) + "\n";
+                                                   auto sent = chrono::steady_clock::now();
+                                                   write_output(client, request);
+                                                   if (!read_response(client, pending))
+                                                       break;
+                                                   latencies[c].push_back(chrono::duration<double, nano>(chrono::steady_clock::now() - sent).count());
+                                               }
+                                               if (client >= 0)
+                                                   close(client);
+                                           });
+                  }
+                  for (thread &worker : workers)
+                      worker.join();
+                  return (long long)clients * requests;
+              });
 
-        return (year == 2025) && (month >= 1 && month <= 12) &&
-               (day >= 1 && day <= 31);
-    }
-    catch (...)
+    vector<double> all;
+    for (const auto &client : latencies)
+        all.insert(all.end(), client.begin(), client.end());
+    sort(all.begin(), all.end());
+    if (!all.empty())
     {
-        return false;
+        results.back().p50_ns = all[all.size() / 2];
+        results.back().p99_ns = all[min(all.size() - 1, all.size() * 99 / 100)];
     }
+    unlink(path.c_str());
 }
 
-string get_month_name(int month)
+void bench_startup(vector<BenchResult> &results)
 {
-    string names[] = {"January", "February", "March", "April", "May", "June",
-                      "July", "August", "September", "October", "November", "December"};
-    return names[month - 1];
+    char directory[] = "/tmp/calendar-bench-XXXXXX";
+    char previous[4096];
+    if (!getcwd(previous, sizeof(previous)) || !mkdtemp(directory) || chdir(directory) != 0)
+        return;
+
+    long long count = 0;
+    {
+        ofstream text("events.csv");
+        for_each_event(days_from_civil(1, 1, 1), days_from_civil(9999, 12, 31), EventFilter(), [&](int handle)
+                       {
+                           const Event &event = event_pool[handle];
+                           text << format_date(event.date) << ',' << event.name << ',' << event.priority << '\n';
+                           count++;
+                       });
+    }
+
+    if (save_store())
+    {
+        bench_clear_store();
+        bench_run(results, "startup_mmap", [&]
+                  {
+                      bench_sink += load_store();
+                      return count;
+                  });
+
+        bench_clear_store();
+        bench_run(results, "startup_text", [&]
+                  {
+                      ifstream text("events.csv");
+                      return import_events(text);
+                  });
+    }
+
+    remove("events.csv");
+    remove(STORE_PATH);
+    if (chdir(previous) == 0)
+        rmdir(directory);
 }
+#endif
 
-void display_header(int month, int year)
+struct LegacyEvent
 {
-    cout << "\033[1;36m" << string(50, '=') << "\n"
-         << "                       " << get_month_name(month) << " " << year << "\n"
-         << string(50, '=') << "\033[0m\n";
-}
+    string date;
+    string name;
+    int priority;
+    string status = "active";
+};
 
-void display_day_events(const string &date)
+struct LegacyTable
 {
-    if (!events_map.contains(date))
-        return;
+    static const int TABLE_SIZE = 31;
+    vector<LegacyEvent> table[TABLE_SIZE];
+
+    int hash(const string &date)
+    {
+        int day = stoi(date.substr(0, 2));
+        int month = stoi(date.substr(3, 2));
+        int year = stoi(date.substr(6, 4));
+        return ((day * 31 + month) * 31 + year) % TABLE_SIZE;
+    }
+
+    void insert(const LegacyEvent &event)
+    {
+        int index = hash(event.date);
+        for (const auto &e : table[index])
+        {
+            if (e.date == event.date && e.name == event.name)
+                return;
+        }
+        table[index].push_back(event);
+    }
 
-    for (const auto &event : events_map.get(date))
+    bool contains(const string &date)
     {
-        string priority_color;
-        switch (event.priority)
+        for (const auto &e : table[hash(date)])
         {
-        case 1:
-            priority_color = "\033[1;31m";
-            break;
-        case 2:
-            priority_color = "\033[1;35m";
-            break;
-        case 3:
-            priority_color = "\033[1;34m";
-            break;
-        case 4:
-            priority_color = "\033[1;32m";
-            break;
-        case 5:
-            priority_color = "\033[1;37m";
-            break;
+            if (e.date == date)
+                return true;
         }
-        cout << priority_color << "  * " << event.name << "\033[0m";
+        return false;
     }
-}
 
-void display_calendar(int month, int year)
+    vector<LegacyEvent> &get(const string &date)
+    {
+        return table[hash(date)];
+    }
+};
+
+void legacy_display_calendar(LegacyTable &table, ostream &out, int month, int year)
 {
-    display_header(month, year);
+    out << "\033[1;36m" << string(50, '=') << "\n"
+        << "                       " << get_month_name(month) << " " << year << "\n"
+        << string(50, '=') << "\033[0m\n";
 
-    vector<string> days = {"Su", "Mo", "Tu", "We", "Th", "Fr", "Sa"};
+    static const vector<string> days = {"Su", "Mo", "Tu", "We", "Th", "Fr", "Sa"};
     for (const auto &d : days)
-        cout << "\033[1;33m" << setw(8) << d << "\033[0m";
-    cout << "\n";
+        out << "\033[1;33m" << setw(8) << d << "\033[0m";
+    out << "\n";
 
     tm time_in = {0, 0, 0, 1, month - 1, year - 1900};
     mktime(&time_in);
     int start_day = time_in.tm_wday;
-    int days_in_month = 31;
-
     int day_counter = 1;
     for (int week = 0; week < 6; week++)
     {
-
         for (int day = 0; day < 7; day++)
         {
-            if ((week == 0 && day < start_day) || day_counter > days_in_month)
+            if ((week == 0 && day < start_day) || day_counter > 31)
             {
-                cout << setw(8) << " ";
+                out << setw(8) << " ";
                 continue;
             }
 
             stringstream date;
             date << setw(2) << setfill('0') << day_counter << "/"
-                 << setw(2) << setfill('0') << month << "/2025";
+                 << setw(2) << setfill('0') << month << "/" << year;
             string date_str = date.str();
 
-            if (events_map.contains(date_str))
-            {
-                cout << "\033[1;32m" << setw(3) << "[" << day_counter << "]" << "\033[0m";
-            }
+            if (table.contains(date_str))
+                out << "\033[1;32m" << setw(3) << "[" << day_counter << "]" << "\033[0m";
             else
-            {
-                cout << setw(4) << day_counter << " ";
-            }
+                out << setw(4) << day_counter << " ";
 
-            if (events_map.contains(date_str))
+            if (table.contains(date_str))
             {
-                display_day_events(date_str);
+                for (const auto &event : table.get(date_str))
+                {
+                    string priority_color;
+                    switch (event.priority)
+                    {
+                    case 1:
+                        priority_color = "\033[1;31m";
+                        break;
+                    case 2:
+                        priority_color = "\033[1;35m";
+                        break;
+                    case 3:
+                        priority_color = "\033[1;34m";
+                        break;
+                    case 4:
+                        priority_color = "\033[1;32m";
+                        break;
+                    case 5:
+                        priority_color = "\033[1;37m";
+                        break;
+                    }
+                    out << priority_color << "  * " << event.name << "\033[0m";
+                }
             }
 
-            cout << setw(8 - (events_map.contains(date_str) ? 4 : 0)) << " ";
+            out << setw(8 - (table.contains(date_str) ? 4 : 0)) << " ";
             day_counter++;
         }
-        cout << "\n";
+        out << "\n";
     }
 }
 
-void add_event()
+void legacy_cleanup_events(LegacyTable &table, int today)
 {
-    Event e;
+    int today_year, today_month, today_day;
+    civil_from_days(today, today_year, today_month, today_day);
 
-    while (true)
+    list<LegacyEvent> events;
+    for (int i = 0; i < LegacyTable::TABLE_SIZE; i++)
     {
-        cout << "Enter date (dd/mm/2025) : ";
-        cin >> e.date;
-        if (validate_date(e.date))
-            break;
-        cout << "\033[1;31mInvalid date!\033[0m ";
+        for (const auto &e : table.table[i])
+            events.push_back(e);
     }
 
-    cout << "Event name: ";
-    cin.ignore();
-    getline(cin, e.name);
-
-    while (true)
+    for (auto &event : events)
     {
-        cout << "Priority (1-5, 1=highest): ";
-        cin >> e.priority;
-        if (e.priority >= 1 && e.priority <= 5)
-            break;
-        cout << "\033[1;31mInvalid priority!\033[0m ";
+        string date = event.date;
+        int day = stoi(date.substr(0, 2));
+        int month = stoi(date.substr(3, 2));
+        int year = stoi(date.substr(6, 4));
+        if (year < today_year || (year == today_year && month < today_month) ||
+            (year == today_year && month == today_month && day < today_day))
+            event.status = "expired";
     }
 
-    priority_queue<Event> pq;
+    for (auto &bucket : table.table)
+        bucket.clear();
+    for (const auto &event : events)
+        table.insert(event);
+}
 
-    if (events_map.contains(e.date))
+void bench_legacy(vector<BenchResult> &results, const BenchConfig &config, const vector<Event> &generated)
+{
+    auto legacy = make_unique<LegacyTable>();
+    for (const Event &e : generated)
     {
-        for (const auto &ev : events_map.get(e.date))
-            pq.push(ev);
+        string date = format_date(e.date);
+        legacy->table[legacy->hash(date)].push_back({date, e.name.str(), e.priority});
     }
 
-    pq.push(e);
-    events_map.get(e.date).clear();
+    ostringstream frame;
+    bench_run(results, "legacy_render", [&]
+              {
+                  int months = min(config.days / 28 + 1, 120);
+                  for (int i = 0; i < months; i++)
+                  {
+                      int year, month, day;
+                      civil_from_days(config.start, year, month, day);
+                      int key = HashTable::month_key(year, month) + i;
+                      frame.str(string());
+                      legacy_display_calendar(*legacy, frame, key % 12 + 1, key / 12);
+                      bench_sink += frame.tellp();
+                  }
+                  return months;
+              });
 
-    while (!pq.empty())
+    int sample = min((int)generated.size(), 20000);
+    LegacyTable &cleaned = *legacy;
+    for (auto &bucket : cleaned.table)
+        bucket.clear();
+    for (int i = 0; i < sample; i++)
     {
-        events_map.get(e.date).push_back(pq.top());
-        pq.pop();
+        string date = format_date(generated[i].date);
+        cleaned.table[cleaned.hash(date)].push_back({date, generated[i].name.str(), generated[i].priority});
     }
+    bench_run(results, "legacy_cleanup", [&]
+              {
+                  legacy_cleanup_events(cleaned, config.start + config.days / 2);
+                  return sample;
+              });
 }
 
-void edit_event()
+void bench_tables(vector<BenchResult> &results, const BenchConfig &config, const vector<int> &dates)
 {
-    string date;
-    cout << "Enter event date to edit (dd/mm/2025): ";
-    cin >> date;
+    mt19937 random(config.seed);
+    uniform_int_distribution<int> any_day(config.start, config.start + config.days - 1);
+    int operations = min((int)dates.size(), 1000);
+    vector<string> date_texts;
+    for (int i = 0; i < operations; i++)
+        date_texts.push_back(format_date(dates[i]));
 
-    if (!events_map.contains(date))
+    for (int size : {1000, 100000, 1000000})
     {
-        cout << "\033[1;31mNo events found!\033[0m\n";
-        return;
-    }
+        string suffix = "_" + to_string(size);
+        {
+            auto legacy = make_unique<LegacyTable>();
+            for (int i = 0; i < size; i++)
+            {
+                string date = format_date(any_day(random));
+                legacy->table[legacy->hash(date)].push_back({date, "event " + to_string(i), i % 5 + 1});
+            }
 
-    vector<Event> events = events_map.get(date);
-    Event events_array[100];
-    int event_count = 0;
+            bench_run(results, "legacy_insert" + suffix, [&]
+                      {
+                          for (int i = 0; i < operations; i++)
+                              legacy->insert({date_texts[i], "added " + to_string(i), 3});
+                          return operations;
+                      });
+            bench_run(results, "legacy_lookup" + suffix, [&]
+                      {
+                          for (int i = 0; i < operations; i++)
+                              bench_sink += legacy->contains(date_texts[i]);
+                          return operations;
+                      });
+        }
 
-    for (const auto &e : events)
-    {
-        events_array[event_count++] = e;
-    }
+        HashTable table;
+        for (int i = 0; i < size; i++)
+            table.get(any_day(random)).push_back(i);
 
-    cout << "Events on " << date << ":\n";
-    for (int i = 0; i < event_count; i++)
-    {
-        cout << i + 1 << ". " << events_array[i].name
-             << " (Priority: " << events_array[i].priority << ")\n";
+        bench_run(results, "index_insert" + suffix, [&]
+                  {
+                      for (int i = 0; i < operations; i++)
+                      {
+                          int date;
+                          parse_date(date_texts[i], date);
+                          table.get(date).push_back(size + i);
+                      }
+                      return operations;
+                  });
+        bench_run(results, "index_lookup" + suffix, [&]
+                  {
+                      for (int i = 0; i < operations; i++)
+                      {
+                          int date;
+                          parse_date(date_texts[i], date);
+                          bench_sink += table.contains(date);
+                      }
+                      return operations;
+                  });
     }
+}
 
-    int choice;
-    cout << "Select event to edit: ";
-    cin >> choice;
-    choice--;
-
-    if (choice < 0 || choice >= event_count)
+int run_bench(int argc, char *argv[])
+{
+    BenchConfig config;
+    for (int i = 2; i < argc; i++)
     {
-        cout << "\033[1;31mInvalid selection!\033[0m\n";
-        return;
+        if (!parse_bench_option(argv[i], config))
+        {
+            cerr << "Usage: --bench [events=N] [days=N] [skew=0..1) [mix=w1,w2,w3,w4,w5] [queries=N] [seed=N]\n";
+            return 1;
+        }
     }
 
-    cout << "New name (" << events_array[choice].name << "): ";
-    cin.ignore();
-    string name;
-    getline(cin, name);
-    if (!name.empty())
-        events_array[choice].name = name;
+    mt19937 random(config.seed);
+    vector<Event> generated = generate_events(config, random);
+    vector<int> dates(config.queries);
+    uniform_int_distribution<int> any_day(config.start, config.start + config.days - 1);
+    for (int &date : dates)
+        date = any_day(random);
 
-    cout << "New priority (" << events_array[choice].priority << "): ";
-    string prio;
-    getline(cin, prio);
-    if (!prio.empty())
-        events_array[choice].priority = stoi(prio);
+    vector<BenchResult> results;
+    bench_storage<PooledStore>(results, "pooled", generated, dates);
+    bench_storage<DirectStore>(results, "direct", generated, dates);
 
-    events_map.get(date).clear();
-    for (int i = 0; i < event_count; i++)
-    {
-        events_map.get(date).push_back(events_array[i]);
-    }
-}
+    bench_run(results, "add", [&]
+              {
+                  for (const Event &e : generated)
+                      insert_event(e);
+                  return generated.size();
+              });
 
-void delete_event()
-{
-    string date;
-    cout << "Enter event date to delete from (dd/mm/2025): ";
-    cin >> date;
+    bench_run(results, "lookup", [&]
+              {
+                  for (int date : dates)
+                      bench_sink += events_map.contains(date);
+                  return dates.size();
+              });
 
-    if (!events_map.contains(date))
+    struct
     {
-        cout << "\033[1;31mNo events found!\033[0m\n";
-        return;
+        const char *name;
+        int days;
+    } ranges[] = {{"range_week", 7}, {"range_month", 30}, {"range_year", 365}};
+    EventFilter filter;
+    for (const auto &range : ranges)
+    {
+        bench_run(results, range.name, [&]
+                  {
+                      int ops = max(1, config.queries * 7 / range.days);
+                      for (int i = 0; i < ops; i++)
+                          for_each_event(dates[i], dates[i] + range.days - 1, filter, [](int handle)
+                                         { bench_sink += handle; });
+                      return ops;
+                  });
     }
 
-    vector<Event> events = events_map.get(date);
-    Event events_array[100];
-    int event_count = 0;
+    vector<int> counts;
+    bench_run(results, "count_month", [&]
+              {
+                  for (int i = 0; i < 10; i++)
+                      count_events(config.start, config.start + config.days - 1, filter, PER_MONTH, counts);
+                  return 10;
+              });
 
-    for (const auto &e : events)
-    {
-        events_array[event_count++] = e;
-    }
+    string frame;
+    bench_run(results, "render", [&]
+              {
+                  int months = min(config.days / 28 + 1, 120);
+                  for (int i = 0; i < months; i++)
+                  {
+                      int year, month, day;
+                      civil_from_days(config.start, year, month, day);
+                      int key = HashTable::month_key(year, month) + i;
+                      frame.clear();
+                      display_calendar(frame, key % 12 + 1, key / 12);
+                      bench_sink += frame.size();
+                  }
+                  return months;
+              });
 
-    cout << "Events on " << date << ":\n";
-    for (int i = 0; i < event_count; i++)
-    {
-        cout << i + 1 << ". " << events_array[i].name
-             << " (Priority: " << events_array[i].priority << ")\n";
-    }
+    bench_present(results, config);
+    bench_rules(results, config, random);
+    bench_journal(results, config);
 
-    int choice;
-    cout << "Select event to delete (0 to cancel): ";
-    cin >> choice;
+    bench_run(results, "edit", [&]
+              {
+                  long long edits = 0;
+                  for (int date : dates)
+                  {
+                      if (!events_map.contains(date))
+                          continue;
+                      const Event &event = event_pool[(*events_map.find(date))[0]];
+                      journal_edit(interactive_journal, date, 0, event.name, event.priority % 5 + 1);
+                      edits++;
+                  }
+                  return edits;
+              });
 
-    if (choice == 0)
-    {
-        cout << "Deletion cancelled.\n";
-        return;
-    }
+    bench_run(results, "undo", [&]
+              {
+                  long long undone = 0;
+                  while (undo_operation(interactive_journal) == STEP_DONE)
+                      undone++;
+                  return undone;
+              });
 
-    choice--;
+    bench_scaling(results, dates);
+    bench_writers(results, dates);
 
-    if (choice < 0 || choice >= event_count)
-    {
-        cout << "\033[1;31mInvalid selection!\033[0m\n";
-        return;
-    }
+    bench_run(results, "delete", [&]
+              {
+                  long long deletes = 0;
+                  for (int date : dates)
+                  {
+                      if (!events_map.contains(date))
+                          continue;
+                      journal_delete(interactive_journal, date, 0);
+                      deletes++;
+                  }
+                  return deletes;
+              });
 
-    Event new_events_array[100];
-    int new_count = 0;
-    for (int i = 0; i < event_count; i++)
-    {
-        if (i != choice)
-        {
-            new_events_array[new_count++] = events_array[i];
-        }
-    }
+    bench_run(results, "cleanup", [&]
+              {
+                  set_fake_today(config.start + config.days / 2);
+                  return event_pool.items.size() - event_pool.free_list.size();
+              });
+    bench_cleanup_readers(results, config);
 
-    events_map.get(date).clear();
-    for (int i = 0; i < new_count; i++)
+#if defined(__unix__) || defined(__APPLE__)
+    bench_socket(results, config, dates);
+    bench_startup(results);
+#endif
+    bench_legacy(results, config, generated);
+    bench_tables(results, config, dates);
+
+    cout << "{\n  \"config\": {\"events\": " << config.events << ", \"days\": " << config.days
+         << ", \"skew\": " << config.skew << ", \"mix\": [";
+    for (int i = 0; i < 5; i++)
+        cout << (i ? ", " : "") << config.mix[i];
+    cout << "], \"queries\": " << config.queries << ", \"seed\": " << config.seed << "},\n"
+         << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
     {
-        events_map.get(date).push_back(new_events_array[i]);
+        cout << "    {\"name\": \"" << results[i].name << "\", \"ops\": " << results[i].ops
+             << ", \"ns_per_op\": " << results[i].ns_per_op
+             << ", \"ops_per_second\": " << 1e9 / results[i].ns_per_op
+             << ", \"allocations_per_op\": " << results[i].allocations_per_op;
+        if (results[i].bytes_per_op >= 0)
+            cout << ", \"bytes_per_op\": " << results[i].bytes_per_op;
+        if (results[i].p50_ns >= 0)
+            cout << ", \"p50_ns\": " << results[i].p50_ns << ", \"p99_ns\": " << results[i].p99_ns;
+        if (results[i].memory_bytes >= 0)
+            cout << ", \"memory_bytes\": " << results[i].memory_bytes;
+        cout << "}"
+             << (i + 1 < results.size() ? ",\n" : "\n");
     }
-
-    cout << "\033[1;32mEvent deleted successfully!\033[0m\n";
+    cout << "  ],\n  \"counters\": {\"hash_lookups\": " << bench_counters.hash_lookups
+         << ", \"hash_probes\": " << bench_counters.hash_probes << ", \"probe_lengths\": [";
+    for (int i = 0; i < PROBE_BUCKETS; i++)
+        cout << (i ? ", " : "") << bench_counters.probe_lengths[i];
+    cout << "], \"day_spills\": " << bench_counters.day_spills
+         << ", \"cleanup_runs\": " << bench_counters.cleanup_runs
+         << ", \"cleanup_touched\": " << bench_counters.cleanup_touched << "},\n"
+         << "  \"peak_rss_kb\": " << peak_rss_kb() << "\n}\n";
+    return 0;
 }
+#endif
 
-void cleanup_events()
+int main(int argc, char *argv[])
 {
-    time_t now = time(nullptr);
-    tm *current = localtime(&now);
+#if defined(CALENDAR_BENCH)
+    if (argc >= 2 && string(argv[1]) == "--bench")
+        return run_bench(argc, argv);
+#endif
 
-    struct Node
+    if (!load_store() || !replay_log())
+    {
+        cout << "\033[1;31mCould not read " << STORE_PATH << " or " << LOG_PATH << "!\033[0m\n";
+        return 1;
+    }
+    if (!load_rules())
     {
-        Event event;
-        Node *next;
-    } *head = nullptr, *tail = nullptr;
+        cout << "\033[1;31mCould not read " << RULES_PATH << "!\033[0m\n";
+        return 1;
+    }
 
-    for (int i = 0; i < HashTable::TABLE_SIZE; i++)
+    if (argc == 3 && string(argv[1]) == "--import")
     {
-        for (const auto &e : events_map.table[i])
+        ios::sync_with_stdio(false);
+        ifstream file;
+        bool from_stdin = string(argv[2]) == "-";
+        if (!from_stdin)
         {
-            Node *newNode = new Node{e};
-            if (!head)
-                head = tail = newNode;
-            else
+            file.open(argv[2]);
+            if (!file)
             {
-                tail->next = newNode;
-                tail = newNode;
+                cerr << "Could not open " << argv[2] << "\n";
+                return 1;
             }
         }
-    }
 
-    Node *current_node = head;
-    while (current_node)
-    {
-        string date = current_node->event.date;
-        int day = stoi(date.substr(0, 2));
-        int month = stoi(date.substr(3, 2));
-        int year = stoi(date.substr(6, 4));
+        auto started = chrono::steady_clock::now();
+        int count = import_events(from_stdin ? cin : file);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - started).count();
 
-        if (year < 2025 || (year == 2025 && month < current->tm_mon + 1) ||
-            (year == 2025 && month == current->tm_mon + 1 && day < current->tm_mday))
+        if (!save_store())
         {
-            current_node->event.status = "expired";
+            cerr << "Could not save " << STORE_PATH << "\n";
+            return 1;
         }
+        ofstream log(LOG_PATH, ios::binary | ios::trunc);
+        write_log_header(log);
 
-        current_node = current_node->next;
+        cout << "Imported " << count << " events in " << seconds << " s ("
+             << (seconds > 0 ? (long long)(count / seconds) : count) << " events/s)\n";
+        return 0;
     }
 
-    events_map.clear();
-    current_node = head;
-    while (current_node)
+    open_log();
+    cleanup_events();
+    expiry_scheduler.start();
+
+    if (argc == 2 && string(argv[1]) == "--batch")
     {
-        events_map.insert(current_node->event);
-        Node *temp = current_node;
-        current_node = current_node->next;
-        delete temp;
+        serve(0, 1);
+        expiry_scheduler.stop();
+        unique_lock lock(store_mutex);
+        compact_store();
+        return 0;
     }
-}
 
-int main()
-{
-    int current_month = 1;
-    int current_year = 2025;
+#if defined(__unix__) || defined(__APPLE__)
+    if (argc == 3 && string(argv[1]) == "--socket")
+        return serve_socket(argv[2]);
+#endif
 
+    int current_year, current_month, current_day;
+    civil_from_days(calendar_today(), current_year, current_month, current_day);
+    Renderer renderer;
     while (true)
     {
-        system("clear || cls");
-        cleanup_events();
-        display_calendar(current_month, current_year);
+        flush_log();
 
-        cout << "\nOptions:\n"
-             << "\033[1;32m[N]\033[0mext \033[1;34m[P]\033[0mprev "
-             << "\033[1;35m[A]\033[0mdd \033[1;33m[E]\033[0mdit "
-             << "\033[1;31m[D]\033[0melete \033[1;36m[Q]\033[0muit\n> ";
+        renderer.frame.clear();
+        {
+            int first = days_from_civil(current_year, current_month, 1);
+            shared_lock store(store_mutex);
+            RangeReadLock months(first, first + days_in_month(current_month, current_year) - 1);
+            display_calendar(renderer.frame, current_month, current_year);
+        }
+        renderer.frame += "\nOptions:\n"
+                          "\033[1;32m[N]\033[0mext \033[1;34m[P]\033[0mprev "
+                          "\033[1;35m[A]\033[0mdd \033[1;33m[E]\033[0mdit "
+                          "\033[1;31m[D]\033[0melete \033[1;36m[Q]\033[0muit \033[1;35m[T]\033[0mop "
+                          "\033[1;33m[R]\033[0mecur \033[1;34m[U]\033[0mndo Red\033[1;32m[O]\033[0m\n> ";
+        renderer.columns = terminal_columns();
+        renderer.screen_rows = terminal_rows();
+        present_frame(renderer);
 
         char choice;
-        cin >> choice;
+        if (!(cin >> choice))
+            choice = 'q';
+        choice = tolower(choice);
+        if (choice != 'n' && choice != 'p')
+            renderer.full_redraw = true;
 
-        switch (tolower(choice))
+        switch (choice)
         {
         case 'n':
-            current_month = (current_month % 12) + 1;
+            if (current_month == 12 && current_year < 9999)
+            {
+                current_month = 1;
+                current_year++;
+            }
+            else if (current_month < 12)
+                current_month++;
             break;
         case 'p':
-            current_month = (current_month == 1) ? 12 : current_month - 1;
+            if (current_month == 1 && current_year > 1)
+            {
+                current_month = 12;
+                current_year--;
+            }
+            else if (current_month > 1)
+                current_month--;
             break;
         case 'a':
             add_event();
@@ -453,8 +4109,31 @@ int main()
         case 'd':
             delete_event();
             break;
+        case 't':
+            urgent_events();
+            break;
+        case 'r':
+            recur_events();
+            break;
+        case 'u':
+        case 'o':
+        {
+            unique_lock lock(store_mutex);
+            bool undo = choice == 'u';
+            StepResult result = undo ? undo_operation(interactive_journal) : redo_operation(interactive_journal);
+            if (result == STEP_NONE)
+                cout << "\033[1;31mNothing to " << (undo ? "undo" : "redo") << "!\033[0m\n";
+            else if (result == STEP_CONFLICT)
+                cout << "\033[1;31mThe event was changed elsewhere, history cleared!\033[0m\n";
+            break;
+        }
         case 'q':
+        {
+            expiry_scheduler.stop();
+            unique_lock lock(store_mutex);
+            compact_store();
             return 0;
+        }
         default:
             cout << "\033[1;31mInvalid choice!\033[0m\n";
         }